@@ -0,0 +1,901 @@
+// Benchmark suite for the ray tracer, a console program over the same unity build as the viewer.
+//
+//   benchmark [--filter text] [--samples N] [--warmup N] [--min-time ms] [--threads N] [--pin]
+//             [--json file] [--csv file] [--compare old.csv] [--list]
+//
+// Every benchmark is warmed up, then timed as a number of samples of enough iterations to last
+// min-time each. Results are per iteration: median, 5/95/99th percentiles, mean, standard
+// deviation, and items (rays, pixels, tasks) per second at the median.
+
+#include "../ray_tracer/tracer.h"
+
+#include <string>
+#include <cmath>
+
+
+// ===================== statistics =====================
+
+struct Bench_options
+{
+    std::string filter;
+    std::string json, csv, compare;
+    int samples = 15;
+    int warmup = 2;
+    double min_time = 0.05;   // seconds per sample
+    bool list = false;
+};
+
+struct Bench_result
+{
+    std::string name;
+    double items = 1;          // work done by one iteration
+    int samples = 0;
+    int iterations = 0;        // per sample
+    double median = 0, mean = 0, stddev = 0, min = 0, p5 = 0, p95 = 0, p99 = 0;   // ns per iteration
+
+    double items_per_second() const { return median > 0 ? items * 1e9 / median : 0; }
+    double spread() const { return median > 0 ? (p95 - p5) / median : 0; }
+};
+
+// linear interpolation between the closest ranks, sorted input
+double percentile(const std::vector<double>& sorted, double p)
+{
+    double rank = p * (sorted.size() - 1);
+    size_t lo = (size_t)rank;
+    size_t hi = lo + 1 < sorted.size() ? lo + 1 : lo;
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+double now_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+struct Bench_suite
+{
+    Bench_options options;
+    std::vector<Bench_result> results;
+
+    bool selected(const std::string& name) const
+    {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    // body() is one iteration doing items units of work
+    template <typename F>
+    void run(const std::string& name, double items, F body)
+    {
+        if (!selected(name)) return;
+        if (options.list)
+        {
+            printf("%s\n", name.c_str());
+            return;
+        }
+
+        // one untimed call, then as many iterations per sample as fit in min_time
+        double start = now_seconds();
+        body();
+        double once = now_seconds() - start;
+        int iterations = once > 0 ? (int)MIN(options.min_time / once + 1, 1e6) : 1000;
+
+        for (int i = 0; i < options.warmup; i++)
+            for (int j = 0; j < iterations; j++)
+                body();
+
+        std::vector<double> times;
+        for (int i = 0; i < options.samples; i++)
+        {
+            start = now_seconds();
+            for (int j = 0; j < iterations; j++)
+                body();
+            times.push_back((now_seconds() - start) * 1e9 / iterations);
+        }
+
+        Bench_result res;
+        res.name = name;
+        res.items = items;
+        res.samples = options.samples;
+        res.iterations = iterations;
+
+        std::sort(times.begin(), times.end());
+        for (double t : times) res.mean += t / times.size();
+        for (double t : times) res.stddev += (t - res.mean) * (t - res.mean) / MAX((int)times.size() - 1, 1);
+        res.stddev = std::sqrt(res.stddev);
+        res.min = times[0];
+        res.median = percentile(times, 0.5);
+        res.p5 = percentile(times, 0.05);
+        res.p95 = percentile(times, 0.95);
+        res.p99 = percentile(times, 0.99);
+
+        printf("%-40s %8d x%-6d %12.0f %12.0f %12.0f %7.1f%% %14.0f%s\n", name.c_str(), res.samples, res.iterations,
+               res.median, res.p5, res.p95, res.stddev / res.mean * 100.0, res.items_per_second(),
+               res.spread() > 0.05 ? "  noisy" : "");
+        results.push_back(res);
+    }
+
+    void print_header() const
+    {
+        if (options.list) return;
+        printf("%-40s %8s %-7s %12s %12s %12s %8s %14s\n", "benchmark", "samples", " iters", "median ns", "p5 ns", "p95 ns", "stddev", "items/s");
+    }
+
+    bool write_json(const char* path) const
+    {
+        FILE* file = open_file(path, "wb");
+        if (!file) return false;
+
+        fprintf(file, "{\n  \"machine\": {\"cores\": %d, \"workers\": %d, \"pinned\": %s, \"numa_nodes\": %d, \"sse41\": %s, \"avx\": %s, \"avx2\": %s, \"fma\": %s, \"debug\": %s},\n",
+                (int)std::thread::hardware_concurrency(), (int)workers.size, workers.pinned ? "true" : "false", workers.nodes,
+                cpu.sse41 ? "true" : "false", cpu.avx ? "true" : "false", cpu.avx2 ? "true" : "false", cpu.fma ? "true" : "false",
+#ifdef NDEBUG
+                "false");
+#else
+                "true");
+#endif
+        fprintf(file, "  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Bench_result& r = results[i];
+            fprintf(file, "    {\"name\": \"%s\", \"samples\": %d, \"iterations\": %d, \"items\": %.0f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, "
+                          "\"min_ns\": %.1f, \"p5_ns\": %.1f, \"p95_ns\": %.1f, \"p99_ns\": %.1f, \"items_per_second\": %.1f}%s\n",
+                    r.name.c_str(), r.samples, r.iterations, r.items, r.median, r.mean, r.stddev, r.min, r.p5, r.p95, r.p99,
+                    r.items_per_second(), i + 1 < results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        return fclose(file) == 0;
+    }
+
+    bool write_csv(const char* path) const
+    {
+        FILE* file = open_file(path, "wb");
+        if (!file) return false;
+
+        fprintf(file, "name,samples,iterations,items,median_ns,mean_ns,stddev_ns,min_ns,p5_ns,p95_ns,p99_ns,items_per_second\n");
+        for (const Bench_result& r : results)
+            fprintf(file, "%s,%d,%d,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", r.name.c_str(), r.samples, r.iterations, r.items,
+                    r.median, r.mean, r.stddev, r.min, r.p5, r.p95, r.p99, r.items_per_second());
+        return fclose(file) == 0;
+    }
+
+    // median change against a csv written by an earlier build, changes inside both runs' spread are marked as noise
+    void compare(const char* path) const
+    {
+        FILE* file = open_file(path, "rb");
+        if (!file)
+        {
+            printf("can't read %s\n", path);
+            return;
+        }
+
+        printf("\n%-40s %12s %12s %9s\n", "compared to", path, "now", "change");
+        char line[512];
+        fgets(line, sizeof(line), file);   // header
+        while (fgets(line, sizeof(line), file))
+        {
+            // name,samples,iterations,items,median,mean,stddev,min,p5,p95,...
+            char* comma = strchr(line, ',');
+            if (!comma) continue;
+            std::string name(line, comma);
+
+            double fields[9];
+            char* pos = comma;
+            int parsed = 0;
+            for (; parsed < 9 && *pos == ','; parsed++)
+                fields[parsed] = strtod(pos + 1, &pos);
+            if (parsed < 9) continue;
+            double median = fields[3], p5 = fields[7], p95 = fields[8];
+
+            for (const Bench_result& r : results)
+            {
+                if (r.name != name) continue;
+                double change = (r.median - median) / median;
+                double noise = MAX((p95 - p5) / median, r.spread()) * 0.5;
+                printf("%-40s %12.0f %12.0f %+8.1f%%%s\n", name.c_str(), median, r.median, change * 100.0, fabs(change) <= noise ? "  (noise)" : "");
+            }
+        }
+        fclose(file);
+    }
+};
+
+
+// ===================== workloads =====================
+
+// primary ray directions of a width x height frame, the same camera as render()
+std::vector<vec3f> primary_rays(int width, int height)
+{
+    std::vector<vec3f> dirs;
+    const int fov = PI / 2.0f;
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+        {
+            float x = (2 * (i + 0.5f) / (float)width - 1.0f) * tan(fov / 2.0f) * width / (float)height;
+            float y = -(2 * (j + 0.5f) / (float)height - 1.0f) * tan(fov / 2.0f);
+            dirs.push_back(vec3f(x, y, -1).normalize());
+        }
+    return dirs;
+}
+
+void make_canvas(Canvas& canvas, int width, int height)
+{
+    canvas.width = width;
+    canvas.height = height;
+    canvas.whole_size = width * height;
+    delete[] canvas.memory;
+    canvas.memory = new Color[canvas.whole_size];
+}
+
+// keeps results alive so the optimizer can't drop the work
+volatile float bench_sink;
+
+
+// Render and post process overlap. Every frame is blitted to a canvas while the next one renders,
+// either with both stages on the shared workers or with the blit on a pool of its own,
+// which is how the old OpenMP loops and the thread pool used to fight over the cores.
+void blit_frame(thread_pool& pool, Canvas& target, Image& frame)
+{
+    pool.parallel_for(0, target.height, 16, [&target, &frame](size_t from_y, size_t to_y)
+    {
+        for (int y = (int)from_y; y < (int)to_y; y++)
+            for (int x = 0; x < target.width; x++)
+                target.memory[y * target.width + x] = frame.get_pixel_scaled(x, y, target.width, target.height);
+    });
+}
+
+void overlap_run(thread_pool& blit_pool, const Scene& scene, fImage& hdr, Image (&frame)[2], Canvas& target, int frames, bool overlap)
+{
+    task_group blits(blit_pool);
+    for (int i = 0; i < frames; i++)
+    {
+        Image& current = frame[i & 1];
+        render(current, hdr, scene);
+
+        if (overlap)
+        {
+            // the other buffer is rendered next, its blit has to be done by then
+            blits.wait();
+            blits.run([&blit_pool, &target, &current]() { blit_frame(blit_pool, target, current); });
+        }
+        else
+        {
+            blit_frame(blit_pool, target, current);
+        }
+    }
+    blits.wait();
+}
+
+
+void ray_benchmarks(Bench_suite& suite)
+{
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+    Render_settings settings;
+
+    std::vector<vec3f> dirs = primary_rays(128, 96);
+    const vec3f orig(0, 0, 0);
+
+    suite.run("intersect/sphere scalar", dirs.size() * scene.spheres.size(), [&]()
+    {
+        float sum = 0;
+        for (const vec3f& dir : dirs)
+            for (const Sphere& sphere : scene.spheres)
+            {
+                float t;
+                if (sphere.ray_intersect(orig, dir, t)) sum += t;
+            }
+        bench_sink = sum;
+    });
+
+    suite.run("intersect/sphere soa", dirs.size() * scene.spheres.size(), [&]()
+    {
+        float sum = 0;
+        for (const vec3f& dir : dirs)
+        {
+            float t = (std::numeric_limits<float>::max)();
+            sum += scene.sphere_soa.closest(orig, dir, t);
+        }
+        bench_sink = sum;
+    });
+
+    suite.run("intersect/scene", dirs.size(), [&]()
+    {
+        float sum = 0;
+        for (const vec3f& dir : dirs)
+        {
+            vec3f hit, N;
+            Material material;
+            if (scene_intersect(orig, dir, scene, hit, N, material)) sum += hit.z;
+        }
+        bench_sink = sum;
+    });
+
+    Cast_ray_kernel kernel = select_kernel(scene, settings);
+    suite.run("cast_ray/random 64", dirs.size(), [&]()
+    {
+        float sum = 0;
+        for (const vec3f& dir : dirs)
+            sum += kernel(orig, dir, scene, settings, NULL, NULL).x;
+        bench_sink = sum;
+    });
+
+    Scene default_scene;
+    load_default_scene(default_scene);
+    Cast_ray_kernel default_kernel = select_kernel(default_scene, settings);
+    suite.run("cast_ray/default", dirs.size(), [&]()
+    {
+        float sum = 0;
+        for (const vec3f& dir : dirs)
+            sum += default_kernel(orig, dir, default_scene, settings, NULL, NULL).x;
+        bench_sink = sum;
+    });
+}
+
+void render_benchmarks(Bench_suite& suite)
+{
+    struct { const char* name; int spheres, lights; } scenes[] = { { "default", 0, 0 }, { "random 64", 64, 8 }, { "random 256", 256, 16 } };
+    struct { int width, height; } sizes[] = { { 320, 240 }, { 640, 480 }, { 1280, 720 } };
+
+    for (auto& desc : scenes)
+    {
+        Scene scene;
+        if (desc.spheres) load_random_scene(scene, desc.spheres, desc.lights);
+        else load_default_scene(scene);
+
+        for (auto& size : sizes)
+        {
+            std::string name = "render/" + std::string(desc.name) + " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+            if (!suite.selected(name)) continue;
+
+            Image frame(size.width, size.height);
+            fImage hdr(size.width, size.height);
+            first_touch(frame, Render_settings().tile_size);
+            first_touch(hdr, Render_settings().tile_size);
+            suite.run(name, size.width * size.height, [&]() { render(frame, hdr, scene); });
+        }
+    }
+}
+
+void draw_benchmarks(Bench_suite& suite)
+{
+    Image image(800, 600);
+    first_touch(image, 16);
+    Canvas canvas;
+
+    struct { int width, height; } sizes[] = { { 800, 600 }, { 1920, 1080 }, { 400, 300 } };
+    for (auto& size : sizes)
+    {
+        make_canvas(canvas, size.width, size.height);
+        suite.run("draw_image/800x600 to " + std::to_string(size.width) + "x" + std::to_string(size.height), size.width * size.height,
+                  [&]() { draw_image(canvas, image, 0.0f, 0.0f, 1.0f, 1.0f); });
+    }
+
+    fImage fimage(800, 600);
+    first_touch(fimage, 16);
+    make_canvas(canvas, 1920, 1080);
+    suite.run("draw_image/float 800x600 to 1920x1080", 1920 * 1080,
+              [&]() { draw_image(canvas, fimage, 0.0f, 0.0f, 1.0f, 1.0f); });
+    suite.run("draw_image/bilinear 800x600 to 1920x1080", 1920 * 1080,
+              [&]() { draw_image(canvas, image, 0.0f, 0.0f, 1.0f, 1.0f, SCALE_BILINEAR); });
+
+    make_canvas(canvas, 400, 300);
+    suite.run("draw_image/box 800x600 to 400x300", 400 * 300,
+              [&]() { draw_image(canvas, image, 0.0f, 0.0f, 1.0f, 1.0f, SCALE_BOX); });
+}
+
+void tonemap_benchmarks(Bench_suite& suite)
+{
+    fImage hdr(1920, 1080);
+    Image out(1920, 1080);
+    first_touch(hdr, 16);
+    first_touch(out, 16);
+    for (int i = 0; i < hdr.width * hdr.height; i++)
+        hdr.data[i] = fColor((i % 1920) / 960.0f, (i / 1920) / 540.0f, 0.5f);
+
+    Tonemap_settings clamp;
+    Tonemap_settings filmic;
+    filmic.op = TONEMAP_ACES;
+    filmic.srgb = true;
+    filmic.dither = true;
+
+    Cpu_features detected = cpu;
+    for (int avx = 0; avx < 2; avx++)
+    {
+        if (avx && !detected.avx) break;
+        cpu.avx = avx;
+        std::string width = avx ? " avx" : " sse";
+        suite.run("tonemap/clamp 1920x1080" + width, hdr.width * hdr.height, [&]() { tonemap(hdr, out, clamp); });
+        suite.run("tonemap/aces srgb dither 1920x1080" + width, hdr.width * hdr.height, [&]() { tonemap(hdr, out, filmic); });
+    }
+    cpu = detected;
+}
+
+// peak signal to noise ratio in dB of the colors clamped to 0..1, what the default tonemap shows
+double psnr(const fImage& image, const fImage& reference)
+{
+    double error = 0;
+    for (int i = 0; i < image.width * image.height; i++)
+        for (int c = 0; c < 3; c++)
+        {
+            double diff = (std::min)((std::max)(image.data[i].raw[c], 0.0f), 1.0f) - (std::min)((std::max)(reference.data[i].raw[c], 0.0f), 1.0f);
+            error += diff * diff;
+        }
+    error /= 3.0 * image.width * image.height;
+    return error > 0 ? 10.0 * log10(1.0 / error) : 999.0;
+}
+
+// One light sampled per camera ray at 1, 4 and 16 samples per pixel, then denoised. The quality
+// is measured against every light shaded with 64 samples per pixel and printed after the times.
+void denoise_benchmarks(Bench_suite& suite)
+{
+    const int width = 320, height = 240;
+    Scene scene;
+    load_random_scene(scene, 64, 32);
+
+    fImage reference(width, height);
+    bool have_reference = false;
+    std::vector<std::string> quality;
+
+    for (int spp : { 1, 4, 16 })
+    {
+        std::string render_name = "denoise/render " + std::to_string(spp) + " spp 320x240";
+        std::string filter_name = "denoise/filter " + std::to_string(spp) + " spp 320x240";
+        if (!suite.selected(render_name) && !suite.selected(filter_name)) continue;
+
+        Render_settings settings;
+        settings.samples = spp;
+        settings.light_samples = 1;
+        Denoise_settings denoise_settings;
+        denoise_settings.samples = spp;
+
+        fImage hdr(width, height), noisy(width, height);
+        Aov_buffers aovs;
+        aovs.resize(width, height, DENOISE_AOVS);
+        Denoise_buffers buffers;
+        suite.run(render_name, width * height, [&]() { render(hdr, scene, settings, NULL, &aovs); });
+        if (suite.options.list)
+        {
+            suite.run(filter_name, width * height, []() {});
+            continue;
+        }
+
+        render(noisy, scene, settings, NULL, &aovs);
+        // the copy back of the noisy input is timed too, it is small next to the filter
+        suite.run(filter_name, width * height, [&]()
+        {
+            memcpy(hdr.data, noisy.data, sizeof(fColor) * width * height);
+            denoise(hdr, aovs, buffers, denoise_settings);
+        });
+
+        if (!have_reference)
+        {
+            Render_settings converged;
+            converged.samples = 64;
+            render(reference, scene, converged);
+            have_reference = true;
+        }
+        memcpy(hdr.data, noisy.data, sizeof(fColor) * width * height);
+        denoise(hdr, aovs, buffers, denoise_settings);
+
+        char line[128];
+        snprintf(line, sizeof(line), "denoise/quality %2d spp: noisy %.2f dB, denoised %.2f dB", spp, psnr(noisy, reference), psnr(hdr, reference));
+        quality.push_back(line);
+    }
+
+    for (auto& line : quality)
+        printf("%s\n", line.c_str());
+}
+
+// what writing the AOVs adds to a render, with none enabled render() skips them
+void aov_benchmarks(Bench_suite& suite)
+{
+    const int width = 640, height = 480;
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+    fImage hdr(width, height);
+    first_touch(hdr, Render_settings().tile_size);
+
+    struct { const char* name; int enabled; } sets[] = {
+        { "none", 0 }, { "denoise", DENOISE_AOVS },
+        { "all", AOV_DEPTH | AOV_NORMAL | AOV_ALBEDO | AOV_MATERIAL_ID | AOV_OBJECT_ID },
+    };
+    Aov_buffers aovs;
+    for (auto& set : sets)
+    {
+        aovs.resize(width, height, set.enabled);
+        suite.run("aov/render " + std::string(set.name) + " 640x480", width * height,
+                  [&]() { render(hdr, scene, Render_settings(), NULL, &aovs); });
+    }
+}
+
+// A light edit rendered from scratch against reshading the captured camera paths
+void relight_benchmarks(Bench_suite& suite)
+{
+    const int width = 640, height = 480;
+    struct { const char* name; int spheres, lights; } scenes[] = { { "default", 0, 0 }, { "random 64", 64, 8 }, { "32 lights", 64, 32 } };
+
+    for (auto& desc : scenes)
+    {
+        Scene scene;
+        if (desc.spheres) load_random_scene(scene, desc.spheres, desc.lights);
+        else load_default_scene(scene);
+
+        fImage hdr(width, height);
+        first_touch(hdr, Render_settings().tile_size);
+        Relight_cache cache;
+        std::string size = " 640x480";
+
+        suite.run("relight/render " + std::string(desc.name) + size, width * height, [&]() { render(hdr, scene); });
+        suite.run("relight/capture " + std::string(desc.name) + size, width * height, [&]() { capture_paths(cache, width, height, scene); });
+        if (cache.tiles.empty()) capture_paths(cache, width, height, scene);
+
+        for (Light& light : scene.lights) light.intensity *= 1.5f;
+        scene.build_lights();
+        suite.run("relight/reshade " + std::string(desc.name) + size, width * height, [&]() { relight(hdr, cache, scene); });
+    }
+}
+
+// The interactive loop driven by a script, one iteration is the whole walk: standing, moving,
+// turning and dragging the view, with one sample and one light per pixel and frame
+void interactive_benchmarks(Bench_suite& suite)
+{
+    const int width = 320, height = 240;
+    Scene scene;
+    load_random_scene(scene, 64, 32);
+    Render_settings settings;
+    settings.light_samples = 1;
+
+    Input_script script;
+    script.parse("5 -\n10 up\n10 left\n5 - 6 -1\n");
+    Image screen(width, height);
+
+    for (int temporal = 0; temporal < 2; temporal++)
+    {
+        Interactive_settings interactive;
+        interactive.temporal = temporal;
+        std::string name = std::string("interactive/walk 320x240") + (temporal ? " temporal" : " single frames");
+        suite.run(name, script.frames.size(), [&]()
+        {
+            Frame_loop loop(scene, settings, width, height, interactive);
+            run_script(loop, script, screen);
+        });
+    }
+}
+
+// Camera jitter of 64 samples from the scalar and the 4 wide generator, and a 16 spp render with
+// one sampled light per hit from each sampler
+void sampler_benchmarks(Bench_suite& suite)
+{
+    float xy[2 * 64];
+    uint32_t pixel = 0;
+    suite.run("sampler/jitter 64 random scalar", 64, [&]()
+    {
+        for (int s = 0; s < 64; s++)
+        {
+            uint32_t pair[2];
+            philox_pair(pixel, s, 0, 1, pair);
+            xy[2 * s] = to_unit_float(pair[0]);
+            xy[2 * s + 1] = to_unit_float(pair[1]);
+        }
+        pixel++;
+    });
+    suite.run("sampler/jitter 64 random sse", 64, [&]() { sample_jitter(SAMPLER_RANDOM, pixel++ & 0xffff, 0, 0, 64, 1, xy); });
+    suite.run("sampler/jitter 64 sobol", 64, [&]() { sample_jitter(SAMPLER_SOBOL, pixel++ & 0xffff, 0, 0, 64, 1, xy); });
+    suite.run("sampler/jitter 64 blue noise", 64, [&]() { sample_jitter(SAMPLER_BLUE_NOISE, pixel++ & 0xffff, 0, 0, 64, 1, xy); });
+
+    const int width = 320, height = 240;
+    Scene scene;
+    load_random_scene(scene, 64, 16);
+    fImage hdr(width, height);
+    const char* names[] = { "random", "sobol", "blue noise" };
+    for (int sampler = 0; sampler < 3; sampler++)
+    {
+        Render_settings settings;
+        settings.samples = 16;
+        settings.light_samples = 1;
+        settings.sampler = sampler;
+        suite.run("sampler/render 16 spp 320x240 " + std::string(names[sampler]), width * height * 16, [&]() { render(hdr, scene, settings); });
+    }
+}
+
+// 4096 small diffuse spheres at 640x480 with and without the bins of the camera rays: building the bins, the
+// first hit of every pixel alone and a whole render, whose shadow rays still test every sphere
+void binning_benchmarks(Bench_suite& suite)
+{
+    const int width = 640, height = 480;
+    Scene scene;
+    load_diffuse_scene(scene, 4096, 1);
+    Render_settings settings;
+    Crop_window frame = Crop_window::pixels(0, 0, width, height, width, height);
+    Tile_bins bins;
+    suite.run("binning/build 4096 spheres", scene.spheres.size(), [&]() { bins.build(scene, settings.camera, frame, settings.tile_size); });
+
+    for (int binned = 0; binned < 2; binned++)
+        suite.run(std::string("binning/first hits 4096 ") + (binned ? "binned" : "all"), width * height, [&]()
+        {
+            float sum = 0;
+            for (int y0 = 0; y0 < height; y0 += settings.tile_size)
+                for (int x0 = 0; x0 < width; x0 += settings.tile_size)
+                {
+                    int x1 = min(x0 + settings.tile_size, width), y1 = min(y0 + settings.tile_size, height);
+                    Sphere_range bin;
+                    const Sphere_range* candidates = binned && bins.find(x0, y0, x1, y1, bin) ? &bin : NULL;
+                    for (int y = y0; y < y1; y++)
+                        for (int x = x0; x < x1; x++)
+                        {
+                            vec3f hit, N;
+                            Material material;
+                            vec3f dir = camera_ray(settings.camera, x + 0.5f, y + 0.5f, width, height);
+                            if (scene_intersect<false>(settings.camera.position, dir, scene, hit, N, material, NULL, candidates)) sum += hit.z;
+                        }
+                }
+            bench_sink = sum;
+        });
+
+    fImage hdr(width, height);
+    for (int binned = 0; binned < 2; binned++)
+    {
+        settings.primary_bins = binned != 0;
+        suite.run(std::string("binning/render 4096 ") + (binned ? "binned" : "all"), width * height, [&]() { render(hdr, scene, settings); });
+    }
+}
+
+// The same frame rendered by the thread pool and by 1, 2 and 4 worker processes on this machine,
+// the workers are started once per count and their start isn't timed
+void distributed_benchmarks(Bench_suite& suite)
+{
+    const int width = 640, height = 480;
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+    Image frame(width, height);
+    fImage hdr(width, height);
+
+    suite.run("distributed/local 640x480", width * height, [&]() { render(frame, hdr, scene); });
+    for (int count = 1; count <= 4; count *= 2)
+    {
+        std::string name = "distributed/" + std::to_string(count) + " workers 640x480";
+        if (!suite.selected(name)) continue;
+
+        Render_farm farm;
+        Distributed_settings settings;
+        settings.workers = count;
+        settings.scene = "random:64:8";
+        if (!farm.start(settings)) continue;
+        suite.run(name, width * height, [&]() { farm.render(frame, hdr, scene, Render_settings()); });
+        if (farm.stats.local_tiles || farm.stats.retried_tiles) printf("  %d tiles rendered locally, %d retried\n", farm.stats.local_tiles, farm.stats.retried_tiles);
+    }
+}
+
+// what a process of the crop benchmarks runs: the crop of one band, on one thread, into a file
+int render_crop_process(const char* region, int width, int height, const char* scene_name, const char* path)
+{
+    Scene scene;
+    Render_settings settings;
+    if (!load_scene(scene, scene_name) || !parse_crop(region, width, height, settings.crop)) return 1;
+
+    fImage crop(settings.crop.width(), settings.crop.height());
+    Cast_ray_kernel kernel = select_kernel(scene, settings);
+    const Crop_window& window = settings.crop;
+    for (int y = window.y0; y < window.y1; y += settings.tile_size)
+        for (int x = window.x0; x < window.x1; x += settings.tile_size)
+            render_tile(crop, scene, settings, kernel, x, y, min(x + settings.tile_size, window.x1), min(y + settings.tile_size, window.y1));
+    return write_crop(path, crop, settings.crop) ? 0 : 1;
+}
+
+// A quarter of the frame as a crop against the whole frame, then the frame split into 1, 2 and 4
+// bands rendered by as many processes with one thread each and merged, their start and scene
+// load included as on a farm
+void crop_benchmarks(Bench_suite& suite)
+{
+    const int width = 640, height = 480;
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+    fImage hdr(width, height), quarter(width / 2, height / 2);
+    Render_settings settings;
+    settings.crop = Crop_window::normalized(0.25f, 0.25f, 0.75f, 0.75f, width, height);
+
+    suite.run("crop/render whole 640x480", width * height, [&]() { render(hdr, scene); });
+    suite.run("crop/render center quarter into the frame", width * height / 4, [&]() { render(hdr, scene, settings); });
+    suite.run("crop/render center quarter compact", width * height / 4, [&]() { render(quarter, scene, settings); });
+
+    for (int count = 1; count <= 4; count *= 2)
+    {
+        std::string name = "crop/split 640x480 " + std::to_string(count) + (count > 1 ? " processes" : " process");
+        if (!suite.selected(name)) continue;
+
+        std::vector<std::string> paths;
+        for (int i = 0; i < count; i++) paths.push_back("crop_benchmark_" + std::to_string(i) + ".crop");
+        bool merged_all = true;
+        suite.run(name, width * height, [&]()
+        {
+            std::vector<Child_process> processes(count);
+            for (int i = 0; i < count; i++)
+            {
+                char region[64];
+                snprintf(region, sizeof(region), "0.0,%.4f,1.0,%.4f", (float)i / count, (float)(i + 1) / count);
+                processes[i].start("-crop " + std::string(region) + " 640 480 random:64:8 " + paths[i]);
+            }
+            for (Child_process& process : processes) process.stop(60000);
+
+            fImage merged;
+            merged_all &= merge_crops(paths, merged) == 0;
+        });
+        if (!merged_all) printf("  the crops didn't cover the frame\n");
+        for (const std::string& path : paths) remove(path.c_str());
+    }
+}
+
+void pool_benchmarks(Bench_suite& suite)
+{
+    const int count = 10000;
+
+    suite.run("pool/add_tasks empty", count, [&]()
+    {
+        std::atomic<int> done{0};
+        workers.add_tasks(count, [&done](size_t) { done++; });
+        while (done < count)
+            if (!workers.try_run_one()) std::this_thread::yield();
+    });
+
+    suite.run("pool/task_group empty", count, [&]()
+    {
+        task_group group(workers);
+        for (int i = 0; i < count; i++)
+            group.run([]() {});
+        group.wait();
+    });
+
+    std::vector<float> data(1 << 20, 1.0f);
+    suite.run("pool/parallel_for 1M floats", data.size(), [&]()
+    {
+        workers.parallel_for(0, data.size(), 4096, [&data](size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; i++) data[i] = data[i] * 0.5f + 0.5f;
+        });
+    });
+}
+
+void overlap_benchmarks(Bench_suite& suite)
+{
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+
+    Image frame[2] = { Image(400, 300), Image(400, 300) };
+    fImage hdr(400, 300);
+    first_touch(frame[0], Render_settings().tile_size);
+    first_touch(frame[1], Render_settings().tile_size);
+    first_touch(hdr, Render_settings().tile_size);
+    Canvas target;
+    make_canvas(target, 800, 600);
+
+    const int frames = 4;
+    suite.run("overlap/serial 400x300", frames, [&]() { overlap_run(workers, scene, hdr, frame, target, frames, false); });
+    suite.run("overlap/shared pool 400x300", frames, [&]() { overlap_run(workers, scene, hdr, frame, target, frames, true); });
+
+    if (!suite.selected("overlap/separate pools 400x300")) return;
+    thread_pool separate(std::thread::hardware_concurrency());
+    suite.run("overlap/separate pools 400x300", frames, [&]() { overlap_run(separate, scene, hdr, frame, target, frames, true); });
+}
+
+// render time for 1, 2, 4 ... threads up to one per core, free and pinned, the pool is restored after
+void scaling_benchmarks(Bench_suite& suite)
+{
+    Scene scene;
+    load_random_scene(scene, 64, 8);
+
+    size_t threads_before = workers.size;
+    bool pinned_before = workers.pinned;
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores == 0) cores = 1;   // the count isn't known
+
+    for (size_t threads = 1; ; threads = MIN(threads * 2, cores))
+    {
+        // a single thread is the caller, there are no workers to pin
+        for (int pin = 0; pin < (threads > 1 ? 2 : 1); pin++)
+        {
+            std::string name = "scaling/render 640x480 " + std::to_string(threads) + (pin ? " threads pinned" : " threads");
+            if (!suite.selected(name)) continue;
+
+            // the calling thread renders too
+            workers.resize(threads > 1 ? threads - 1 : thread_pool::no_workers, pin);
+
+            // allocated after the resize so the first touch follows the new workers
+            Image frame(640, 480);
+            fImage hdr(640, 480);
+            first_touch(frame, Render_settings().tile_size);
+            first_touch(hdr, Render_settings().tile_size);
+            suite.run(name, 640 * 480, [&]() { render(frame, hdr, scene); });
+        }
+        if (threads >= cores) break;
+    }
+
+    workers.resize(threads_before, pinned_before);
+}
+
+
+// ===================== entry =====================
+
+void print_hints()
+{
+    printf("cores %d, workers %d%s, numa nodes %d, sse4.1 %d avx %d avx2 %d fma %d\n",
+           (int)std::thread::hardware_concurrency(), (int)workers.size, workers.pinned ? " pinned" : "", workers.nodes,
+           cpu.sse41, cpu.avx, cpu.avx2, cpu.fma);
+#ifndef NDEBUG
+    printf("warning: debug build, numbers are not representative\n");
+#endif
+#ifdef PROFILER
+    printf("warning: built with PROFILER, zones add overhead\n");
+#endif
+    printf("for stable numbers: use the high performance power plan and fix the clock\n"
+           "(powercfg /setactive SCHEME_MIN, or disable turbo in the bios), close other programs\n"
+           "and run with --pin. results marked noisy have a p5..p95 spread over 5%% of the median.\n\n");
+}
+
+int main(int argc, char** argv)
+{
+#ifdef _WIN32
+    al_init(GetModuleHandle(NULL));
+#else
+    al_init();
+#endif
+    Bench_suite suite;
+    int threads = 0;
+    bool pin = false;
+
+    // started by the distributed benchmarks as -worker PORT -scene NAME
+    if (argc >= 3 && std::string(argv[1]) == "-worker")
+        return run_worker(atoi(argv[2]), argc >= 5 ? argv[4] : "default");
+    // and by the crop benchmarks as -crop REGION WIDTH HEIGHT SCENE FILE
+    if (argc >= 7 && std::string(argv[1]) == "-crop")
+        return render_crop_process(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5], argv[6]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--filter" && has_value) suite.options.filter = argv[++i];
+        else if (arg == "--samples" && has_value) suite.options.samples = (std::max)(atoi(argv[++i]), 1);
+        else if (arg == "--warmup" && has_value) suite.options.warmup = atoi(argv[++i]);
+        else if (arg == "--min-time" && has_value) suite.options.min_time = atof(argv[++i]) * 1e-3;
+        else if (arg == "--threads" && has_value) threads = atoi(argv[++i]);
+        else if (arg == "--pin") pin = true;
+        else if (arg == "--json" && has_value) suite.options.json = argv[++i];
+        else if (arg == "--csv" && has_value) suite.options.csv = argv[++i];
+        else if (arg == "--compare" && has_value) suite.options.compare = argv[++i];
+        else if (arg == "--list") suite.options.list = true;
+        else
+        {
+            printf("usage: benchmark [--filter text] [--samples N] [--warmup N] [--min-time ms] [--threads N] [--pin]\n"
+                   "                 [--json file] [--csv file] [--compare old.csv] [--list]\n");
+            return 1;
+        }
+    }
+
+    if (threads > 0 || pin) workers.resize(threads, pin);
+    if (!suite.options.list) print_hints();
+    suite.print_header();
+
+    ray_benchmarks(suite);
+    render_benchmarks(suite);
+    draw_benchmarks(suite);
+    tonemap_benchmarks(suite);
+    denoise_benchmarks(suite);
+    aov_benchmarks(suite);
+    relight_benchmarks(suite);
+    interactive_benchmarks(suite);
+    sampler_benchmarks(suite);
+    binning_benchmarks(suite);
+    distributed_benchmarks(suite);
+    crop_benchmarks(suite);
+    pool_benchmarks(suite);
+    overlap_benchmarks(suite);
+    scaling_benchmarks(suite);
+
+    if (!suite.options.json.empty() && !suite.write_json(suite.options.json.c_str()))
+        printf("can't write %s\n", suite.options.json.c_str());
+    if (!suite.options.csv.empty() && !suite.write_csv(suite.options.csv.c_str()))
+        printf("can't write %s\n", suite.options.csv.c_str());
+    if (!suite.options.compare.empty())
+        suite.compare(suite.options.compare.c_str());
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Arbitrary output variables: what the camera rays hit first, for compositing and the denoiser.
+// Every channel is a plane of its own. Only the requested ones are allocated and written, with
+// none requested render() doesn't touch them at all.
+
+#define FAR_DEPTH 1000.0f   // depth of the pixels that hit nothing, scene_intersect gives up there too
+
+enum Aov
+{
+    AOV_DEPTH       = 1 << 0,   // distance along the camera ray
+    AOV_NORMAL      = 1 << 1,   // world space, 3 planes
+    AOV_ALBEDO      = 1 << 2,   // diffuse color, 3 planes
+    AOV_MATERIAL_ID = 1 << 3,   // equal materials share an id, -1 where nothing was hit
+    AOV_OBJECT_ID   = 1 << 4,   // sphere index, the checkerboard comes after the spheres, -1 where nothing was hit
+};
+
+// what a camera ray hit first
+struct Primary_hit
+{
+    vec3f normal;
+    vec3f albedo;
+    float depth;
+    int material_id;
+    int object_id;
+};
+
+
+// Rows top first like render() writes them. Depth, normal and albedo are averaged over the
+// samples of a pixel, the ids come from its first sample.
+struct Aov_buffers
+{
+    int width = 0, height = 0;
+    int enabled = 0;   // Aov flags
+
+    std::vector<float> depth;
+    std::vector<float> normal[3];
+    std::vector<float> albedo[3];
+    std::vector<float> material_id;
+    std::vector<float> object_id;
+
+    // allocates the enabled planes and frees the others, the same size and flags again don't allocate
+    void resize(int width, int height, int enabled)
+    {
+        this->width = width;
+        this->height = height;
+        this->enabled = enabled;
+
+        size_t size = (size_t)width * height;
+        auto fit = [size](std::vector<float>& plane, bool on) {
+            if (on) plane.resize(size);
+            else std::vector<float>().swap(plane);
+        };
+        fit(depth, enabled & AOV_DEPTH);
+        for (int c = 0; c < 3; c++) fit(normal[c], enabled & AOV_NORMAL);
+        for (int c = 0; c < 3; c++) fit(albedo[c], enabled & AOV_ALBEDO);
+        fit(material_id, enabled & AOV_MATERIAL_ID);
+        fit(object_id, enabled & AOV_OBJECT_ID);
+    }
+
+    bool has(int aovs) const { return (enabled & aovs) == aovs; }
+
+    void set(int idx, const Primary_hit& hit)
+    {
+        if (enabled & AOV_DEPTH) depth[idx] = hit.depth;
+        if (enabled & AOV_NORMAL) {
+            normal[0][idx] = hit.normal.x;
+            normal[1][idx] = hit.normal.y;
+            normal[2][idx] = hit.normal.z;
+        }
+        if (enabled & AOV_ALBEDO) {
+            albedo[0][idx] = hit.albedo.x;
+            albedo[1][idx] = hit.albedo.y;
+            albedo[2][idx] = hit.albedo.z;
+        }
+        if (enabled & AOV_MATERIAL_ID) material_id[idx] = hit.material_id;
+        if (enabled & AOV_OBJECT_ID) object_id[idx] = hit.object_id;
+    }
+
+    // one EXR layer per enabled AOV, beauty (same size, rows top first) as R, G, B if given
+    bool write_exr(const char* path, const fImage* beauty = NULL) const
+    {
+        std::vector<Exr_channel> channels;
+        if (beauty) {
+            channels.push_back({ "R", &beauty->data[0].r, 4 });
+            channels.push_back({ "G", &beauty->data[0].g, 4 });
+            channels.push_back({ "B", &beauty->data[0].b, 4 });
+        }
+        if (enabled & AOV_DEPTH) channels.push_back({ "Z", depth.data(), 1 });
+        if (enabled & AOV_NORMAL) {
+            channels.push_back({ "N.X", normal[0].data(), 1 });
+            channels.push_back({ "N.Y", normal[1].data(), 1 });
+            channels.push_back({ "N.Z", normal[2].data(), 1 });
+        }
+        if (enabled & AOV_ALBEDO) {
+            channels.push_back({ "albedo.R", albedo[0].data(), 1 });
+            channels.push_back({ "albedo.G", albedo[1].data(), 1 });
+            channels.push_back({ "albedo.B", albedo[2].data(), 1 });
+        }
+        if (enabled & AOV_MATERIAL_ID) channels.push_back({ "materialID", material_id.data(), 1 });
+        if (enabled & AOV_OBJECT_ID) channels.push_back({ "objectID", object_id.data(), 1 });
+        return ::write_exr(path, width, height, channels);
+    }
+};
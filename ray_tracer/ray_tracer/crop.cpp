@@ -0,0 +1,103 @@
+// Crops of a frame rendered apart, on other processes or machines, and merged into the frame. A
+// crop file is a header with the frame size and the crop's rectangle followed by its linear colors,
+// rows top first; the random numbers only depend on the pixel, so the merged frame is the same as
+// one rendered in one go.
+
+struct Crop_header
+{
+    char magic[8];   // "RTCROP1"
+    int32_t frame_width, frame_height;
+    int32_t x0, y0, x1, y1;
+};
+
+// "x0,y0,x1,y1" in pixels, or in 0..1 of the frame if any of them has a decimal point
+bool parse_crop(const std::string& text, int frame_width, int frame_height, Crop_window& crop)
+{
+    float values[4];
+    const char* p = text.c_str();
+    for (int i = 0; i < 4; i++)
+    {
+        char* end;
+        values[i] = strtof(p, &end);
+        if (end == p || (i < 3 && *end != ',')) return false;
+        p = end + 1;
+    }
+
+    if (text.find('.') != std::string::npos)
+        crop = Crop_window::normalized(values[0], values[1], values[2], values[3], frame_width, frame_height);
+    else
+        crop = Crop_window::pixels((int)values[0], (int)values[1], (int)values[2], (int)values[3], frame_width, frame_height);
+    return !crop.empty();
+}
+
+// image is the crop only, written next to path and renamed, a merge never reads half a crop
+bool write_crop(const std::string& path, fImage& image, const Crop_window& crop)
+{
+    assert(image.width == crop.width() && image.height == crop.height());
+    Crop_header header = {};
+    memcpy(header.magic, "RTCROP1", 8);
+    header.frame_width = crop.frame_width;
+    header.frame_height = crop.frame_height;
+    header.x0 = crop.x0;
+    header.y0 = crop.y0;
+    header.x1 = crop.x1;
+    header.y1 = crop.y1;
+
+    std::string temporary = path + ".tmp";
+    FILE* file = open_file(temporary.c_str(), "wb");
+    if (!file) return false;
+    const size_t pixels = (size_t)image.width * image.height;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(image.data, sizeof(fColor), pixels, file) == pixels;
+    ok = fclose(file) == 0 && ok;
+    if (ok && replace_file(temporary, path)) return true;
+    remove(temporary.c_str());
+    return false;
+}
+
+// Adds the crop in path to frame, which is made the crop's frame size if it's empty. covered is
+// set to 1 for its pixels. False if the file isn't a crop of a frame of that size.
+bool merge_crop(const std::string& path, fImage& frame, std::vector<uint8_t>& covered)
+{
+    FILE* file = open_file(path.c_str(), "rb");
+    if (!file) return false;
+
+    Crop_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "RTCROP1", 8) == 0 &&
+              header.x0 >= 0 && header.y0 >= 0 && header.x0 < header.x1 && header.y0 < header.y1 &&
+              header.x1 <= header.frame_width && header.y1 <= header.frame_height;
+    if (ok && !frame.data)
+    {
+        frame.resize(header.frame_width, header.frame_height);
+        std::fill(frame.data, frame.data + (size_t)frame.width * frame.height, fColor(0.0f, 0.0f, 0.0f));
+        covered.assign((size_t)frame.width * frame.height, 0);
+    }
+    ok = ok && frame.width == header.frame_width && frame.height == header.frame_height;
+
+    // straight into the frame, row by row
+    const int width = header.x1 - header.x0;
+    for (int y = header.y0; ok && y < header.y1; y++)
+    {
+        ok = fread(&frame.data[header.x0 + y * frame.width], sizeof(fColor), width, file) == (size_t)width;
+        for (int x = header.x0; ok && x < header.x1; x++) covered[x + y * frame.width] = 1;
+    }
+    ok = ok && fgetc(file) == EOF;
+    fclose(file);
+    return ok;
+}
+
+// Assembles the crops in paths into frame, which gets their frame size and black where no crop is
+// if it's empty (default constructed), otherwise they're put over what it has. Returns the pixels
+// no crop covered, or -1 if a file couldn't be merged. Of overlapping crops the last one wins.
+int merge_crops(const std::vector<std::string>& paths, fImage& frame)
+{
+    PROFILE_ZONE("merge crops");
+    std::vector<uint8_t> covered;
+    if (frame.data) covered.assign((size_t)frame.width * frame.height, 0);
+    for (const std::string& path : paths)
+        if (!merge_crop(path, frame, covered))
+        {
+            doutput("can't merge %s\n", path.c_str());
+            return -1;
+        }
+    return (int)std::count(covered.begin(), covered.end(), 0);
+}
@@ -0,0 +1,258 @@
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) for renders with few samples per
+// pixel. Every pass blurs with a 5x5 B3 spline whose taps are 2^pass pixels apart and weights
+// each tap down where the color, the first hit normal, albedo or depth differ from the center,
+// so the noise between edges is averaged away while the edges stay. It works on the planes of
+// the AOV buffers, 4 or 8 neighbouring pixels per register.
+
+#define DENOISE_AOVS (AOV_DEPTH | AOV_NORMAL | AOV_ALBEDO)   // what render() has to write for denoise()
+
+struct Denoise_settings
+{
+    int passes = 5;              // the last pass reaches 2 * 2^(passes - 1) pixels
+    int samples = 1;             // per pixel of the render, the noise falls with the square root
+    float sigma_color = 8.0f;    // at 1 sample per pixel, halved every pass as the noise left is smaller too
+    float sigma_normal = 0.3f;
+    float sigma_albedo = 0.2f;
+    float sigma_depth = 0.05f;   // relative to the depth of the center pixel
+};
+
+// r, g, b planes of the color while it's filtered, ping-ponged between the passes.
+// Kept between frames they are allocated once.
+struct Denoise_buffers
+{
+    std::vector<float> color[2][3];
+
+    void resize(size_t size)
+    {
+        for (auto& planes : color)
+            for (auto& plane : planes)
+                plane.resize(size);
+    }
+};
+
+
+// e^x for x <= 0, split into 2^integer and a polynomial for the fraction, about 1e-7 relative error.
+// Below e^-30 it is 0, the weighted colors would be denormals otherwise and those are very slow.
+inline __m128 exp_negative(__m128 x)
+{
+    __m128 keep = _mm_cmpgt_ps(x, _mm_set1_ps(-30.0f));
+    __m128 t = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-30.0f)), _mm_set1_ps(1.44269504f));
+    __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+    whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, t), _mm_set1_ps(1.0f)));   // floor
+    __m128 f = _mm_sub_ps(t, whole);
+
+    __m128 p = _mm_set1_ps(1.3333558e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+    __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23);
+    return _mm_and_ps(_mm_mul_ps(p, _mm_castsi128_ps(exponent)), keep);
+}
+
+SIMD_INLINE float4 exp_negative(const float4& x) { return exp_negative(x.m); }
+
+AVX_BEGIN
+
+// the same 8 wide, AVX has no 256 bit integer ops so the exponent is built in halves
+inline __m256 exp_negative(__m256 x)
+{
+    __m256 keep = _mm256_cmp_ps(x, _mm256_set1_ps(-30.0f), _CMP_GT_OQ);
+    __m256 t = _mm256_mul_ps(_mm256_max_ps(x, _mm256_set1_ps(-30.0f)), _mm256_set1_ps(1.44269504f));
+    __m256 whole = _mm256_floor_ps(t);
+    __m256 f = _mm256_sub_ps(t, whole);
+
+    __m256 p = _mm256_set1_ps(1.3333558e-3f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.6181291e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.5504109e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.4022651e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.9314718e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+    __m256i i = _mm256_cvttps_epi32(whole);
+    __m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(i), _mm_set1_epi32(127)), 23);
+    __m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(i, 1), _mm_set1_epi32(127)), 23);
+    __m256 exponent = _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    return _mm256_and_ps(_mm256_mul_ps(p, exponent), keep);
+}
+
+inline float8 exp_negative(const float8& x) { return exp_negative(x.m); }
+
+AVX_END
+
+
+static const float atrous_kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+struct Atrous_pass
+{
+    const float* src[3];
+    float* dst[3];
+    const float* normal[3];
+    const float* albedo[3];
+    const float* depth;
+    int width, height, step;
+    float inv_color, inv_normal, inv_albedo, inv_depth;   // 1 / sigma^2
+
+    Atrous_pass(const std::vector<float> (&src)[3], std::vector<float> (&dst)[3], const Aov_buffers& aovs, const Denoise_settings& settings, int pass) :
+        depth(aovs.depth.data()), width(aovs.width), height(aovs.height), step(1 << pass)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            this->src[c] = src[c].data();
+            this->dst[c] = dst[c].data();
+            normal[c] = aovs.normal[c].data();
+            albedo[c] = aovs.albedo[c].data();
+        }
+        float sigma_color = settings.sigma_color / (sqrtf(max(settings.samples, 1)) * (1 << pass));
+        inv_color = 1.0f / (sigma_color * sigma_color);
+        inv_normal = 1.0f / (settings.sigma_normal * settings.sigma_normal);
+        inv_albedo = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+        inv_depth = 1.0f / (settings.sigma_depth * settings.sigma_depth);
+    }
+};
+
+// pixels x.. of a row, one per lane, outside the image the edge pixels repeat
+template <typename F>
+SIMD_INLINE F load_block(const float* plane, int row, int x, int width)
+{
+    const int lanes = sizeof(F) / sizeof(float);
+    if (x >= 0 && x + lanes <= width) return F::load(plane + row + x);
+
+    float gathered[lanes];
+    for (int k = 0; k < lanes; k++)
+        gathered[k] = plane[row + max(0, min(x + k, width - 1))];
+    return F::load(gathered);
+}
+
+template <typename F>
+SIMD_INLINE F squared(const F& x) { return x * x; }
+
+// filters the pixels x.. of row y, the weights of a tap are computed for all of them at once
+template <typename F>
+SIMD_INLINE void atrous_block(const Atrous_pass& pass, int x, int y)
+{
+    const int lanes = sizeof(F) / sizeof(float);
+    const int width = pass.width;
+    const int row = y * width;
+
+    F color[3], normal[3], albedo[3];
+    for (int c = 0; c < 3; c++)
+    {
+        color[c] = load_block<F>(pass.src[c], row, x, width);
+        normal[c] = load_block<F>(pass.normal[c], row, x, width);
+        albedo[c] = load_block<F>(pass.albedo[c], row, x, width);
+    }
+    const F depth = load_block<F>(pass.depth, row, x, width);
+    const F depth_weight = F(pass.inv_depth) / (depth * depth + F(1e-6f));
+
+    F sum[3] = { F(0.0f), F(0.0f), F(0.0f) };
+    F weight_sum(0.0f);
+
+    for (int dy = -2; dy <= 2; dy++)
+    {
+        const int tap_row = max(0, min(y + dy * pass.step, pass.height - 1)) * width;
+        for (int dx = -2; dx <= 2; dx++)
+        {
+            const int tap_x = x + dx * pass.step;
+            F tap[3];
+            F e(0.0f);
+            for (int c = 0; c < 3; c++)
+            {
+                tap[c] = load_block<F>(pass.src[c], tap_row, tap_x, width);
+                e = e + squared(color[c] - tap[c]) * F(pass.inv_color);
+                e = e + squared(normal[c] - load_block<F>(pass.normal[c], tap_row, tap_x, width)) * F(pass.inv_normal);
+                e = e + squared(albedo[c] - load_block<F>(pass.albedo[c], tap_row, tap_x, width)) * F(pass.inv_albedo);
+            }
+            e = e + squared(depth - load_block<F>(pass.depth, tap_row, tap_x, width)) * depth_weight;
+            F w = exp_negative(F(0.0f) - e) * F(atrous_kernel[dx + 2] * atrous_kernel[dy + 2]);
+
+            for (int c = 0; c < 3; c++)
+                sum[c] = sum[c] + tap[c] * w;
+            weight_sum = weight_sum + w;
+        }
+    }
+
+    // the last block of a row may stick out of the image, only the pixels inside are written
+    const int count = min(lanes, width - x);
+    for (int c = 0; c < 3; c++)
+    {
+        F result = sum[c] / weight_sum;
+        if (count == lanes)
+        {
+            result.store(pass.dst[c] + row + x);
+            continue;
+        }
+        float stored[lanes];
+        result.store(stored);
+        for (int k = 0; k < count; k++)
+            pass.dst[c][row + x + k] = stored[k];
+    }
+}
+
+template <typename F>
+SIMD_INLINE void atrous_rows(const Atrous_pass& pass, int y0, int y1)
+{
+    const int lanes = sizeof(F) / sizeof(float);
+    for (int y = y0; y < y1; y++)
+        for (int x = 0; x < pass.width; x += lanes)
+            atrous_block<F>(pass, x, y);
+}
+
+AVX_BEGIN
+
+SIMD_FLATTEN void atrous_rows_avx(const Atrous_pass& pass, int y0, int y1)
+{
+    atrous_rows<float8>(pass, y0, y1);
+}
+
+AVX_END
+
+SIMD_FLATTEN void atrous_rows_sse(const Atrous_pass& pass, int y0, int y1)
+{
+    atrous_rows<float4>(pass, y0, y1);
+}
+
+
+// Denoises the linear colors of a render in place. aovs must come from the same render with at
+// least DENOISE_AOVS enabled, buffers are resized if needed and can be kept for the next frame.
+void denoise(fImage& hdr, const Aov_buffers& aovs, Denoise_buffers& buffers, const Denoise_settings& settings = Denoise_settings())
+{
+    PROFILE_ZONE("denoise");
+    assert(aovs.has(DENOISE_AOVS) && aovs.width == hdr.width && aovs.height == hdr.height);
+    const int count = hdr.width * hdr.height;
+    buffers.resize(count);
+
+    // the filter runs on the light arriving at the surfaces, the albedo is multiplied back afterwards
+    const float eps = 0.01f;
+    workers.parallel_for(0, count, 4096, [&](size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; i++)
+        {
+            buffers.color[0][0][i] = hdr.data[i].r / (aovs.albedo[0][i] + eps);
+            buffers.color[0][1][i] = hdr.data[i].g / (aovs.albedo[1][i] + eps);
+            buffers.color[0][2][i] = hdr.data[i].b / (aovs.albedo[2][i] + eps);
+        }
+    });
+
+    int src = 0;
+    for (int pass = 0; pass < settings.passes; pass++)
+    {
+        Atrous_pass atrous(buffers.color[src], buffers.color[src ^ 1], aovs, settings, pass);
+        workers.parallel_for(0, hdr.height, 4, [&atrous](size_t from_y, size_t to_y)
+        {
+            if (cpu.avx) atrous_rows_avx(atrous, from_y, to_y);
+            else atrous_rows_sse(atrous, from_y, to_y);
+        });
+        src ^= 1;
+    }
+
+    workers.parallel_for(0, count, 4096, [&](size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; i++)
+            hdr.data[i] = fColor(buffers.color[src][0][i] * (aovs.albedo[0][i] + eps),
+                                 buffers.color[src][1][i] * (aovs.albedo[1][i] + eps),
+                                 buffers.color[src][2][i] * (aovs.albedo[2][i] + eps));
+    });
+}
@@ -0,0 +1,340 @@
+// Rendering the tiles of a frame in worker processes. The coordinator starts the workers as
+// copies of its own executable with -worker PORT -scene NAME; each loads the scene once, connects
+// back over localhost and renders the tiles it's sent one after the other. The coordinator keeps a
+// few tiles in flight per worker and puts the returned ones into the image. A worker that dies,
+// closes its connection or doesn't answer in time is killed, its tiles go back into the queue and
+// a replacement is started; when no worker is left the rest of the frame is rendered locally.
+
+#include <deque>
+#include <type_traits>
+
+#define FARM_MAGIC 0x52544652u   // "RFTR"
+
+// both sides are the same executable, so the structs go over the connection as they are
+static_assert(std::is_trivially_copyable<Render_settings>::value, "Render_settings is sent as raw bytes");
+
+struct Worker_hello
+{
+    uint32_t magic;
+    int32_t process_id;       // matches the connection to the process the coordinator started
+    uint32_t settings_size;   // sizeof(Render_settings), a different build doesn't get tiles
+};
+
+struct Tile_request
+{
+    uint32_t magic;
+    int32_t tile;
+    int32_t x0, y0, x1, y1;
+    int32_t width, height;    // of the whole frame, the camera rays depend on it
+    Render_settings settings;
+};
+
+// followed by the linear colors of the tile, rows top first
+struct Tile_reply
+{
+    uint32_t magic;
+    int32_t tile;
+    int32_t pixels;
+};
+
+
+struct Distributed_settings
+{
+    int workers = 4;                  // processes, each renders one tile at a time
+    std::string scene = "default";    // load_scene() name, the coordinator's scene has to be the same
+    std::string worker_args;          // appended to the workers' command lines
+    int tiles_in_flight = 2;          // per worker, so it has the next tile while its reply is on the way
+    int tile_timeout_ms = 10000;      // a worker that answers nothing for that long is considered dead
+    int connect_timeout_ms = 10000;   // from the start of a worker to its connection
+    int max_restarts = 8;             // replacement workers over the farm's life
+};
+
+struct Distributed_stats
+{
+    int tiles = 0;           // of the last frame
+    int remote_tiles = 0;    // rendered by the workers
+    int local_tiles = 0;     // rendered by the coordinator after the workers were gone
+    int retried_tiles = 0;   // sent again after their worker failed
+    int restarts = 0;        // over the farm's life
+};
+
+
+// A pool of worker processes, started once and kept for every frame until stop().
+struct Render_farm
+{
+    struct Node
+    {
+        Child_process process;
+        socket_t socket = BAD_SOCKET;
+        std::deque<int> pending;   // tiles sent to it, they come back in this order
+        high_resolution_clock::time_point since;   // start of the process, or the last reply while it has tiles
+
+        bool connected() const { return socket != BAD_SOCKET; }
+    };
+
+    Distributed_settings settings;
+    Distributed_stats stats;
+    std::vector<Node> nodes;
+    socket_t listener = BAD_SOCKET;
+    int port = 0;
+
+    ~Render_farm() { stop(); }
+
+    // starts the workers, false if even the listening socket failed; the workers connect while
+    // the first frame is rendered
+    bool start(const Distributed_settings& farm_settings)
+    {
+        stop();
+        settings = farm_settings;
+        stats = Distributed_stats();
+        if (!net_init()) return false;
+        port = 0;
+        listener = listen_local(port);
+        if (listener == BAD_SOCKET) return false;
+
+        nodes.resize((std::max)(settings.workers, 0));
+        for (Node& node : nodes) spawn(node);
+        return true;
+    }
+
+    // closing the connections ends the workers, the ones that don't exit are killed
+    void stop()
+    {
+        for (Node& node : nodes)
+        {
+            close_socket(node.socket);
+            node.socket = BAD_SOCKET;
+        }
+        for (Node& node : nodes) node.process.stop(1000);
+        nodes.clear();
+        close_socket(listener);
+        listener = BAD_SOCKET;
+    }
+
+    int alive() const
+    {
+        int count = 0;
+        for (const Node& node : nodes) count += node.connected() || node.process.id() > 0;
+        return count;
+    }
+
+    // Renders the frame, or only render_settings.crop of it, into hdr and tonemaps every returned
+    // tile into surface. hdr is the whole frame either way. scene is used for the tiles rendered
+    // locally when no worker is left.
+    void render(Image& surface, fImage& hdr, const Scene& scene, const Render_settings& render_settings)
+    {
+        PROFILE_ZONE("distributed render");
+        const Crop_window window = render_window(hdr, render_settings);
+        const int tile_size = render_settings.tile_size;
+        const int tiles_x = (window.width() + tile_size - 1) / tile_size;
+        const int tiles_y = (window.height() + tile_size - 1) / tile_size;
+
+        std::deque<int> queue;
+        for (int tile = 0; tile < tiles_x * tiles_y; tile++) queue.push_back(tile);
+        stats.tiles = tiles_x * tiles_y;
+        stats.remote_tiles = stats.local_tiles = stats.retried_tiles = 0;
+
+        Tile_request request = {};
+        request.magic = FARM_MAGIC;
+        request.width = hdr.width;
+        request.height = hdr.height;
+        request.settings = render_settings;
+
+        std::vector<fColor> pixels;
+        std::vector<socket_t> sockets;
+        std::vector<Node*> owners;
+        std::vector<bool> ready;
+        int done = 0;
+
+        while (done < stats.tiles)
+        {
+            auto now = high_resolution_clock::now();
+            for (Node& node : nodes)
+            {
+                // not connected yet, or no answer in time
+                if (!node.connected() && node.process.id() > 0 &&
+                    (!node.process.running() || now - node.since > milliseconds(settings.connect_timeout_ms)))
+                    fail(node, queue);
+                else if (node.connected() && !node.pending.empty() && now - node.since > milliseconds(settings.tile_timeout_ms))
+                    fail(node, queue);
+
+                while (node.connected() && queue.size() && (int)node.pending.size() < settings.tiles_in_flight)
+                {
+                    int tile = queue.front();
+                    queue.pop_front();
+                    request.tile = tile;
+                    tile_rect(tile, window, tiles_x, tile_size, request.x0, request.y0, request.x1, request.y1);
+                    if (node.pending.empty()) node.since = now;
+                    node.pending.push_back(tile);
+                    if (!send_all(node.socket, &request, sizeof(request))) fail(node, queue);
+                }
+            }
+
+            if (alive() == 0)
+            {
+                render_locally(surface, hdr, scene, render_settings, queue, window, tiles_x);
+                done += (int)queue.size();
+                stats.local_tiles += (int)queue.size();
+                queue.clear();
+                break;
+            }
+
+            sockets.assign(1, listener);
+            owners.assign(1, NULL);
+            for (Node& node : nodes)
+                if (node.connected())
+                {
+                    sockets.push_back(node.socket);
+                    owners.push_back(&node);
+                }
+            if (!wait_readable(sockets, 20, ready)) continue;
+
+            if (ready[0]) accept_worker();
+            for (size_t i = 1; i < sockets.size(); i++)
+            {
+                if (!ready[i]) continue;
+                Node& node = *owners[i];
+                if (receive_tile(node, hdr, pixels, window, tiles_x, tile_size))
+                {
+                    int tile = node.pending.front();
+                    node.pending.pop_front();
+                    node.since = high_resolution_clock::now();
+                    int x0, y0, x1, y1;
+                    tile_rect(tile, window, tiles_x, tile_size, x0, y0, x1, y1);
+                    tonemap(hdr, surface, render_settings.tonemap, x0, y0, x1, y1);
+                    stats.remote_tiles++;
+                    done++;
+                }
+                else
+                    fail(node, queue);
+            }
+        }
+    }
+
+private:
+    // the pixels of tile in the grid of tile_size squares, tiles_x per row, that starts at the corner of window
+    static void tile_rect(int tile, const Crop_window& window, int tiles_x, int tile_size, int32_t& x0, int32_t& y0, int32_t& x1, int32_t& y1)
+    {
+        x0 = window.x0 + (tile % tiles_x) * tile_size;
+        y0 = window.y0 + (tile / tiles_x) * tile_size;
+        x1 = (std::min)(x0 + tile_size, window.x1);
+        y1 = (std::min)(y0 + tile_size, window.y1);
+    }
+
+    void spawn(Node& node)
+    {
+        node.since = high_resolution_clock::now();
+        std::string args = "-worker " + std::to_string(port) + " -scene " + settings.scene;
+        if (!settings.worker_args.empty()) args += " " + settings.worker_args;
+        if (!node.process.start(args)) doutput("can't start a render worker\n");
+    }
+
+    // the worker is gone for good, its tiles go back to the front of the queue
+    void fail(Node& node, std::deque<int>& queue)
+    {
+        stats.retried_tiles += (int)node.pending.size();
+        queue.insert(queue.begin(), node.pending.begin(), node.pending.end());
+        node.pending.clear();
+        close_socket(node.socket);
+        node.socket = BAD_SOCKET;
+        node.process.stop();
+
+        if (stats.restarts < settings.max_restarts)
+        {
+            stats.restarts++;
+            spawn(node);
+        }
+    }
+
+    void accept_worker()
+    {
+        socket_t s = accept_socket(listener);
+        if (s == BAD_SOCKET) return;
+
+        Worker_hello hello;
+        if (recv_all(s, &hello, sizeof(hello)) && hello.magic == FARM_MAGIC && hello.settings_size == sizeof(Render_settings))
+            for (Node& node : nodes)
+                if (!node.connected() && node.process.id() == hello.process_id)
+                {
+                    node.socket = s;
+                    return;
+                }
+        close_socket(s);
+    }
+
+    // the reply to the oldest tile the node has, into hdr
+    bool receive_tile(Node& node, fImage& hdr, std::vector<fColor>& pixels, const Crop_window& window, int tiles_x, int tile_size)
+    {
+        Tile_reply reply;
+        if (node.pending.empty() || !recv_all(node.socket, &reply, sizeof(reply))) return false;
+
+        const int tile = node.pending.front();
+        int x0, y0, x1, y1;
+        tile_rect(tile, window, tiles_x, tile_size, x0, y0, x1, y1);
+        if (reply.magic != FARM_MAGIC || reply.tile != tile || reply.pixels != (x1 - x0) * (y1 - y0)) return false;
+
+        pixels.resize(reply.pixels);
+        if (!recv_all(node.socket, pixels.data(), pixels.size() * sizeof(fColor))) return false;
+        for (int y = y0; y < y1; y++)
+            memcpy(&hdr.data[x0 + y * hdr.width], &pixels[(y - y0) * (x1 - x0)], (x1 - x0) * sizeof(fColor));
+        return true;
+    }
+
+    void render_locally(Image& surface, fImage& hdr, const Scene& scene, const Render_settings& render_settings, const std::deque<int>& queue,
+                        const Crop_window& window, int tiles_x)
+    {
+        PROFILE_ZONE("local tiles");
+        const int tile_size = render_settings.tile_size;
+        Cast_ray_kernel kernel = select_kernel(scene, render_settings);
+        Tile_bins bins;
+        const Tile_bins* primary = bin_spheres(bins, scene, render_settings, window);
+        workers.parallel_for(0, queue.size(), 1, [&](size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; i++)
+            {
+                int x0, y0, x1, y1;
+                tile_rect(queue[i], window, tiles_x, tile_size, x0, y0, x1, y1);
+                render_tile(hdr, scene, render_settings, kernel, x0, y0, x1, y1, NULL, NULL, primary);
+                tonemap(hdr, surface, render_settings.tonemap, x0, y0, x1, y1);
+            }
+        });
+    }
+};
+
+
+// The worker side, what -worker PORT runs instead of the viewer: loads the scene, connects to the
+// coordinator and renders the tiles it's sent until the connection closes. Returns the exit code.
+int run_worker(int port, const std::string& scene_name)
+{
+    Scene scene;
+    if (!net_init() || !load_scene(scene, scene_name)) return 1;
+    socket_t s = connect_local(port);
+    if (s == BAD_SOCKET) return 1;
+
+    Worker_hello hello = { FARM_MAGIC, current_process_id(), (uint32_t)sizeof(Render_settings) };
+    fImage hdr(1, 1);
+    Tile_bins bins;
+    std::vector<fColor> pixels;
+    Tile_request request;
+    bool ok = send_all(s, &hello, sizeof(hello));
+
+    while (ok && recv_all(s, &request, sizeof(request)) && request.magic == FARM_MAGIC)
+    {
+        PROFILE_ZONE("worker tile");
+        if (hdr.width != request.width || hdr.height != request.height) hdr.resize(request.width, request.height);
+        // binned for this tile alone, the worker gets the tiles in no particular order
+        Crop_window tile = Crop_window::pixels(request.x0, request.y0, request.x1, request.y1, request.width, request.height);
+        const Tile_bins* primary = bin_spheres(bins, scene, request.settings, tile);
+        render_tile(hdr, scene, request.settings, select_kernel(scene, request.settings), request.x0, request.y0, request.x1, request.y1, NULL, NULL, primary);
+
+        const int w = request.x1 - request.x0;
+        pixels.resize((size_t)w * (request.y1 - request.y0));
+        for (int y = request.y0; y < request.y1; y++)
+            memcpy(&pixels[(y - request.y0) * w], &hdr.data[request.x0 + y * hdr.width], w * sizeof(fColor));
+
+        Tile_reply reply = { FARM_MAGIC, request.tile, (int32_t)pixels.size() };
+        ok = send_all(s, &reply, sizeof(reply)) && send_all(s, pixels.data(), pixels.size() * sizeof(fColor));
+    }
+    close_socket(s);
+    return 0;
+}
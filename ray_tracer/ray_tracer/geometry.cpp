@@ -13,7 +13,7 @@ struct vec3
 	vec3() : x(0), y(0), z(0) {}
 	vec3(T x, T y, T z) : x(x), y(y), z(z) {}
 
-	vec3 operator - (vec3 other) const
+	vec3 operator - (const vec3& other) const
 	{
 		return vec3(x - other.x, y - other.y, z - other.z);
 	}
@@ -23,7 +23,7 @@ struct vec3
 		return vec3(-x, -y, -z);
 	}
 
-	float operator * (vec3 other) const
+	float operator * (const vec3& other) const
 	{
 		return x * other.x + y * other.y + z * other.z;
 	}
@@ -33,17 +33,17 @@ struct vec3
 		return vec3(x * mul, y * mul, z * mul);
 	}
 
-	vec3 operator + (vec3 other) const
+	vec3 operator + (const vec3& other) const
 	{
 		return vec3(x + other.x, y + other.y, z + other.z);
 	}
 
-	float norm()
+	float norm() const
 	{
 		return sqrtf(x * x + y * y + z * z);
 	}
 
-	vec3 normalize()
+	vec3 normalize() const
 	{
 		float n = 1.0f / norm();
 		return vec3(x * n, y * n, z * n);
@@ -51,9 +51,90 @@ struct vec3
 
 };
 
+// SSE specialization, padded to 16 bytes, w is kept at zero
+template <>
+struct alignas(16) vec3<float>
+{
+	union
+	{
+		struct { float x, y, z, w; };
+		float raw[4];
+		__m128 m;
+	};
+
+	vec3() : m(_mm_setzero_ps()) {}
+	vec3(float x, float y, float z) : m(_mm_set_ps(0, z, y, x)) {}
+	explicit vec3(__m128 m) : m(m) {}
+
+	vec3 operator - (const vec3& other) const
+	{
+		return vec3(_mm_sub_ps(m, other.m));
+	}
+
+	vec3 operator - () const
+	{
+		return vec3(_mm_sub_ps(_mm_setzero_ps(), m));
+	}
+
+	float operator * (const vec3& other) const
+	{
+		__m128 p = _mm_mul_ps(m, other.m);
+		__m128 s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(p, p)));
+	}
+
+	vec3 operator * (float mul) const
+	{
+		return vec3(_mm_mul_ps(m, _mm_set1_ps(mul)));
+	}
+
+	vec3 operator + (const vec3& other) const
+	{
+		return vec3(_mm_add_ps(m, other.m));
+	}
+
+	float norm() const
+	{
+		float n2 = *this * *this;
+		return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(n2)));
+	}
+
+	vec3 normalize() const
+	{
+		float n2 = *this * *this;
+		return vec3(_mm_mul_ps(m, _mm_set1_ps(rsqrt(n2))));
+	}
+};
+
 typedef vec3<float> vec3f;
 
 
+// SoA vectors with one ray or primitive per lane
+template <typename F>
+struct vec3_wide
+{
+	F x, y, z;
+
+	vec3_wide() = default;
+	SIMD_INLINE vec3_wide(const F& x, const F& y, const F& z) : x(x), y(y), z(z) {}
+	SIMD_INLINE vec3_wide(const vec3f& v) : x(v.x), y(v.y), z(v.z) {}
+
+	SIMD_INLINE vec3_wide operator - (const vec3_wide& o) const { return vec3_wide(x - o.x, y - o.y, z - o.z); }
+	SIMD_INLINE vec3_wide operator + (const vec3_wide& o) const { return vec3_wide(x + o.x, y + o.y, z + o.z); }
+	SIMD_INLINE vec3_wide operator * (const F& mul) const { return vec3_wide(x * mul, y * mul, z * mul); }
+	SIMD_INLINE F operator * (const vec3_wide& o) const { return x * o.x + y * o.y + z * o.z; }
+
+	SIMD_INLINE F norm() const { return sqrt(*this * *this); }
+	SIMD_INLINE vec3_wide normalize() const { return *this * rsqrt(*this * *this); }
+};
+
+typedef vec3_wide<float4> vec3x4;
+
+AVX_BEGIN
+typedef vec3_wide<float8> vec3x8;
+AVX_END
+
+
 template <typename T>
 struct vec2
 {
@@ -23,6 +23,7 @@ struct Color
 		r *= f;
 		g *= f;
 		b *= f;
+		return *this;
 	}
 };
 
@@ -33,10 +34,13 @@ struct Canvas
 	int whole_size;
 	Color* memory = nullptr;
 
+#ifdef _WIN32
 	BITMAPINFO bitmap_info;
+#endif
 
 	~Canvas() { delete[] memory; }
 
+#ifdef _WIN32
 	void resize(HWND hwnd)
 	{
 		RECT rect;
@@ -58,10 +62,11 @@ struct Canvas
 		bitmap_info.bmiHeader.biBitCount = 32;
 		bitmap_info.bmiHeader.biCompression = BI_RGB;
 	}
+#endif
 
 	Color& operator [] (int inx)
 	{
-		assert((uint32_t)inx < whole_size);
+		assert((uint32_t)inx < (uint32_t)whole_size);
 		return memory[inx];
 	}
 
@@ -3,7 +3,7 @@
 
 inline void drawPixel(Canvas& surface, int x, int y, Color color)
 {
-	if ((uint32_t)y >= surface.height || (uint32_t)x >= surface.width) return;
+	if ((uint32_t)y >= (uint32_t)surface.height || (uint32_t)x >= (uint32_t)surface.width) return;
 	surface[y * surface.width + x] = color;
 }
 
@@ -72,22 +72,11 @@ inline void draw_filled_rect(Canvas& surface, float fx, float fy, float fwidth,
 	int width = surface.width * fwidth;
 	int height = surface.height * fheight;
 
-	std::future<void> res[MAX_THREADS];
-
-	for (int i = 0; i < workers.size; i++)
-	{
-		int from_x = x0 + (i) * width / workers.size;
-		int to_x = x0 + (i + 1)*width / workers.size;
-
-		res[i] = workers.add_task([y0, height, from_x, to_x, &surface, &color]() {
-			for (int y = y0; y < y0 + height; y++)
-				for (int x = from_x; x < to_x; x++)
-					drawPixel(surface, x, y, color);
-		});
-	}
-
-	for (int i = 0; i < MAX_THREADS; i++)
-		res[i].get();
+	workers.parallel_for(MAX(y0, 0), MAX(y0 + height, 0), 16, [x0, width, &surface, &color](size_t from_y, size_t to_y) {
+		for (int y = (int)from_y; y < (int)to_y; y++)
+			for (int x = x0; x < x0 + width; x++)
+				drawPixel(surface, x, y, color);
+	});
 }
 
 
@@ -96,7 +85,7 @@ inline void draw_filled_rect(Canvas& surface, float fx, float fy, float fwidth,
 
 inline void drawPixel(Image& surface, int x, int y, Color color)
 {
-	if ((uint32_t)y >= surface.height || (uint32_t)x >= surface.width) return;
+	if ((uint32_t)y >= (uint32_t)surface.height || (uint32_t)x >= (uint32_t)surface.width) return;
 	surface[y * surface.width + x] = color;
 }
 
@@ -165,20 +154,9 @@ inline void draw_filled_rect(Image& surface, float fx, float fy, float fwidth, f
 	int width = surface.width * fwidth;
 	int height = surface.height * fheight;
 
-	std::future<void> res[MAX_THREADS];
-
-	for (int i = 0; i < workers.size; i++)
-	{
-		int from_x = x0 + (i)*width / workers.size;
-		int to_x = x0 + (i + 1) * width / workers.size;
-
-		res[i] = workers.add_task([y0, height, from_x, to_x, &surface, &color]() {
-			for (int y = y0; y < y0 + height; y++)
-				for (int x = from_x; x < to_x; x++)
-					drawPixel(surface, x, y, color);
-		});
-	}
-
-	for (int i = 0; i < MAX_THREADS; i++)
-		res[i].get();
+	workers.parallel_for(MAX(y0, 0), MAX(y0 + height, 0), 16, [x0, width, &surface, &color](size_t from_y, size_t to_y) {
+		for (int y = (int)from_y; y < (int)to_y; y++)
+			for (int x = x0; x < x0 + width; x++)
+				drawPixel(surface, x, y, color);
+	});
 }
\ No newline at end of file
@@ -1,3 +1,16 @@
+#include <emmintrin.h>
+
+
+// a wide file name as the UTF-8 one stbi_load takes, wcstombs relies on a UTF-8 locale outside Windows
+inline void utf8_path(char* out, int size, const wchar_t* path)
+{
+#ifdef _WIN32
+	stbi_convert_wchar_to_utf8(out, size, path);
+#else
+	if (wcstombs(out, path, size) == (size_t)-1) out[0] = 0;
+	out[size - 1] = 0;
+#endif
+}
 
 // ============= standart image ==================
 
@@ -12,7 +25,7 @@ struct Image
 	{
 		int chanels;
 		char filename[256];
-		stbi_convert_wchar_to_utf8(filename, sizeof(filename), filename_utf8);
+		utf8_path(filename, sizeof(filename), filename_utf8);
 
 		uint8_t* raw = stbi_load(filename, &width, &height, &chanels, 0);
 
@@ -73,13 +86,13 @@ struct Image
 
 	Color& get_pixel(int x, int y)
 	{
-		assert(((uint32_t)y < height) | ((uint32_t)x < width));
+		assert(((uint32_t)y < (uint32_t)height) | ((uint32_t)x < (uint32_t)width));
 		return data[y * width + x];
 	}
 	
 	Color& operator [] (int idx)
 	{
-		assert((uint32_t)idx < width * height);
+		assert((uint32_t)idx < (uint32_t)(width * height));
 		return data[idx];
 	}
 
@@ -88,7 +101,7 @@ struct Image
 		y = y * height / screen_h;
 		x = x * width / screen_w;
 	
-		assert(((uint32_t)y < height) | ((uint32_t)x < width));
+		assert(((uint32_t)y < (uint32_t)height) | ((uint32_t)x < (uint32_t)width));
 		return data[y * width + x];
 	}
 
@@ -96,44 +109,6 @@ struct Image
 };
 
 
-void draw_image(Canvas& surface, Image& image,
-				float fpos_x, float fpos_y, float fwidth, float fheight)
-{
-	if (fpos_x > 1.0f || fpos_y > 1.0f || fpos_x < 0.0f || fpos_y < 0.0f) return;
-
-	int pos_x = surface.width * fpos_x;
-	int pos_y = surface.height *fpos_y;
-
-	fwidth = min(fwidth, 1.0f - fpos_x);
-	fheight= min(fheight, 1.0f - fpos_y);
-
-	int width  = surface.width * fwidth;
-	int height = surface.height * fheight;
-
-	std::future<void> res[MAX_THREADS];
-
-	for (int i = 0; i < workers.size; i++)
-	{
-		int from_x = i * width / workers.size;
-		int to_x   = (i + 1) * width / workers.size;
-
-		res[i] = workers.add_task([from_x, to_x, pos_y, pos_x, height, width, &surface, &image]()
-		{
-			for (int y = 0; y < height; y++)
-				for (int x = from_x; x < to_x; x++)
-				{
-					assert(x < surface.width);
-					Color color = image.get_pixel_scaled(x, y, width, height);
-					surface.memory[(y + pos_y) * surface.width + (x + pos_x)] = color;
-				}
-		});
-	}
-	
-	for (int i = 0; i < workers.size; i++)
-		res[i].get();
-}
-
-
 // =============== float Image  ==================
 
 
@@ -161,6 +136,7 @@ struct fColor
 		r *= f;
 		g *= f;
 		b *= f;
+		return *this;
 	}
 
 	Color get_uint()
@@ -181,7 +157,7 @@ struct fImage
 	{
 		int chanels;
 		char filename[256];
-		stbi_convert_wchar_to_utf8(filename, sizeof(filename), filename_utf8);
+		utf8_path(filename, sizeof(filename), filename_utf8);
 
 		uint8_t* raw = stbi_load(filename, &width, &height, &chanels, 0);
 
@@ -253,13 +229,13 @@ struct fImage
 
 	fColor& get_pixel(int x, int y)
 	{
-		assert(((uint32_t)y < height) | ((uint32_t)x < width));
+		assert(((uint32_t)y < (uint32_t)height) | ((uint32_t)x < (uint32_t)width));
 		return data[y * width + x];
 	}
 
 	fColor& operator [] (int idx)
 	{
-		assert((uint32_t)idx < width * height);
+		assert((uint32_t)idx < (uint32_t)(width * height));
 		return data[idx];
 	}
 
@@ -268,16 +244,191 @@ struct fImage
 		y = y * height / screen_h;
 		x = x * width / screen_w;
 
-		assert(((uint32_t)y < height) | ((uint32_t)x < width));
+		assert(((uint32_t)y < (uint32_t)height) | ((uint32_t)x < (uint32_t)width));
 		return data[y * width + x];
 	}
 
 };
 
 
-void draw_image(Canvas& surface, fImage& image,
-	float fpos_x, float fpos_y, float fwidth, float fheight)
+// ============= scaling ==================
+
+enum Scale_filter
+{
+	SCALE_NEAREST,
+	SCALE_BILINEAR,    // for upscaling
+	SCALE_BOX,         // average of the covered source pixels, for downscaling supersampled renders
+};
+
+
+// pixel as b, g, r, a floats in 0..255
+inline __m128 load_pixel(const Color& c)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c.whole), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+inline __m128 load_pixel(const fColor& c)
+{
+	return _mm_mul_ps(_mm_loadu_ps(c.raw), _mm_set1_ps(255.0f));
+}
+
+// truncated and saturated to 8 bits like Color's constructor, without the wrap around
+inline Color pack_pixel(__m128 v)
+{
+	__m128i i = _mm_cvttps_epi32(v);
+	i = _mm_packs_epi32(i, i);
+	Color c;
+	c.whole = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+	return c;
+}
+
+
+inline void nearest_row(Color* out, const Color* row, const int* src_x, int width, int src_width)
+{
+	if (width == src_width)
+	{
+		memcpy(out, row, sizeof(Color) * width);
+		return;
+	}
+	for (int x = 0; x < width; x++)
+		out[x] = row[src_x[x]];
+}
+
+inline __m128i pack_pixels(const fColor& a, const fColor& b, const fColor& c, const fColor& d, __m128 scale)
+{
+	__m128i p0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(a.raw), scale));
+	__m128i p1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(b.raw), scale));
+	__m128i p2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(c.raw), scale));
+	__m128i p3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(d.raw), scale));
+	return _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+}
+
+// four pixels per store, without the column map when the width stays
+inline void nearest_row(Color* out, const fColor* row, const int* src_x, int width, int src_width)
+{
+	const __m128 scale = _mm_set1_ps(255.0f);
+	int x = 0;
+	if (width == src_width)
+	{
+		for (; x + 4 <= width; x += 4)
+			_mm_storeu_si128((__m128i*)&out[x], pack_pixels(row[x], row[x + 1], row[x + 2], row[x + 3], scale));
+	}
+	else
+	{
+		for (; x + 4 <= width; x += 4)
+			_mm_storeu_si128((__m128i*)&out[x], pack_pixels(row[src_x[x]], row[src_x[x + 1]], row[src_x[x + 2]], row[src_x[x + 3]], scale));
+	}
+	for (; x < width; x++)
+		out[x] = pack_pixel(load_pixel(row[src_x[x]]));
+}
+
+
+// Scales image into the width x height rectangle at dst, rows stride pixels apart. The column
+// map is built once per call and the rows are split over the workers.
+template <typename Img>
+void scale_image(Color* dst, int stride, int width, int height, Img& image, Scale_filter filter = SCALE_NEAREST)
+{
+	if (width <= 0 || height <= 0 || image.width <= 0 || image.height <= 0) return;
+	const int src_w = image.width;
+	const int src_h = image.height;
+
+	if (filter == SCALE_NEAREST)
+	{
+		std::vector<int> src_x(width);
+		for (int x = 0; x < width; x++)
+			src_x[x] = x * src_w / width;
+
+		workers.parallel_for(0, height, 16, [&](size_t from_y, size_t to_y)
+		{
+			for (int y = (int)from_y; y < (int)to_y; y++)
+				nearest_row(dst + y * stride, &image.data[(y * src_h / height) * src_w], src_x.data(), width, src_w);
+		});
+		return;
+	}
+
+	if (filter == SCALE_BILINEAR)
+	{
+		// pixel centers line up, the edges are clamped
+		struct tap { int x0, x1; float w; };
+		auto make_tap = [](int i, int dst_size, int src_size)
+		{
+			float u = max(0.0f, (i + 0.5f) * src_size / dst_size - 0.5f);
+			tap t;
+			t.x0 = min((int)u, src_size - 1);
+			t.x1 = min(t.x0 + 1, src_size - 1);
+			t.w = u - (int)u;
+			return t;
+		};
+
+		std::vector<tap> taps(width);
+		for (int x = 0; x < width; x++)
+			taps[x] = make_tap(x, width, src_w);
+
+		workers.parallel_for(0, height, 16, [&](size_t from_y, size_t to_y)
+		{
+			for (int y = (int)from_y; y < (int)to_y; y++)
+			{
+				tap ty = make_tap(y, height, src_h);
+				auto* row0 = &image.data[ty.x0 * src_w];
+				auto* row1 = &image.data[ty.x1 * src_w];
+				__m128 wy = _mm_set1_ps(ty.w);
+				Color* out = dst + y * stride;
+
+				for (int x = 0; x < width; x++)
+				{
+					const tap& tx = taps[x];
+					__m128 wx = _mm_set1_ps(tx.w);
+					__m128 a = load_pixel(row0[tx.x0]), b = load_pixel(row0[tx.x1]);
+					__m128 c = load_pixel(row1[tx.x0]), d = load_pixel(row1[tx.x1]);
+					__m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+					__m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), wx));
+					__m128 v = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wy));
+					out[x] = pack_pixel(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+				}
+			}
+		});
+		return;
+	}
+
+	// box, every output pixel averages the source pixels it covers, at least one
+	std::vector<int> box_x(width + 1);
+	for (int x = 0; x <= width; x++)
+		box_x[x] = x * src_w / width;
+
+	workers.parallel_for(0, height, 16, [&](size_t from_y, size_t to_y)
+	{
+		for (int y = (int)from_y; y < (int)to_y; y++)
+		{
+			int y0 = y * src_h / height;
+			int y1 = max((int)((y + 1) * src_h / height), y0 + 1);
+			Color* out = dst + y * stride;
+
+			for (int x = 0; x < width; x++)
+			{
+				int x0 = box_x[x];
+				int x1 = max(box_x[x + 1], x0 + 1);
+
+				__m128 sum = _mm_setzero_ps();
+				for (int sy = y0; sy < y1; sy++)
+				{
+					auto* row = &image.data[sy * src_w];
+					for (int sx = x0; sx < x1; sx++)
+						sum = _mm_add_ps(sum, load_pixel(row[sx]));
+				}
+				__m128 inv = _mm_set1_ps(1.0f / ((x1 - x0) * (y1 - y0)));
+				out[x] = pack_pixel(_mm_add_ps(_mm_mul_ps(sum, inv), _mm_set1_ps(0.5f)));
+			}
+		}
+	});
+}
+
+
+template <typename Img>
+void draw_scaled(Canvas& surface, Img& image, float fpos_x, float fpos_y, float fwidth, float fheight, Scale_filter filter)
 {
+	PROFILE_ZONE("draw image");
 	if (fpos_x > 1.0f || fpos_y > 1.0f || fpos_x < 0.0f || fpos_y < 0.0f) return;
 
 	int pos_x = surface.width * fpos_x;
@@ -289,25 +440,223 @@ void draw_image(Canvas& surface, fImage& image,
 	int width = surface.width * fwidth;
 	int height = surface.height * fheight;
 
-	std::future<void> res[MAX_THREADS];
+	scale_image(surface.memory + pos_y * surface.width + pos_x, surface.width, width, height, image, filter);
+}
+
+void draw_image(Canvas& surface, Image& image,
+				float fpos_x, float fpos_y, float fwidth, float fheight, Scale_filter filter = SCALE_NEAREST)
+{
+	draw_scaled(surface, image, fpos_x, fpos_y, fwidth, fheight, filter);
+}
+
+void draw_image(Canvas& surface, fImage& image,
+				float fpos_x, float fpos_y, float fwidth, float fheight, Scale_filter filter = SCALE_NEAREST)
+{
+	draw_scaled(surface, image, fpos_x, fpos_y, fwidth, fheight, filter);
+}
+
 
-	for (int i = 0; i < workers.size; i++)
+// Zeroes a freshly allocated image with the tile split the renderer will use. new[] doesn't touch
+// the pages, so each one is placed on the NUMA node of the pinned worker that writes it first.
+template <typename Img>
+void first_touch(Img& image, int tile_size)
+{
+	int width = image.width;
+	workers.parallel_for_2d(0, 0, image.width, image.height, tile_size, tile_size, [width, &image](int x0, int y0, int x1, int y1)
 	{
-		int from_x = i * width / workers.size;
-		int to_x = (i + 1) * width / workers.size;
+		for (int y = y0; y < y1; y++)
+			memset(&image.data[y * width + x0], 0, sizeof(image.data[0]) * (x1 - x0));
+	});
+}
+
 
-		res[i] = workers.add_task([from_x, to_x, pos_y, pos_x, height, width, &surface, &image]()
+// ============== file output ==================
+// Both formats keep the bottom row first, the same as Image and fImage.
+
+bool write_bmp(const char* path, Image& image)
+{
+	FILE* file = open_file(path, "wb");
+	if (!file) return false;
+
+	int row_size = (image.width * 3 + 3) & ~3;
+	uint32_t data_size = row_size * image.height;
+
+	uint8_t header[54] = { 'B', 'M' };
+	auto put32 = [&header](int pos, uint32_t v) { for (int i = 0; i < 4; i++) header[pos + i] = (v >> (8 * i)) & 0xff; };
+	put32(2, 54 + data_size);
+	put32(10, 54);
+	put32(14, 40);
+	put32(18, image.width);
+	put32(22, image.height);
+	header[26] = 1;		// planes
+	header[28] = 24;	// bits per pixel
+	put32(34, data_size);
+	fwrite(header, 1, sizeof(header), file);
+
+	std::vector<uint8_t> row(row_size, 0);
+	for (int y = 0; y < image.height; y++)
+	{
+		for (int x = 0; x < image.width; x++)
 		{
-			for (int y = 0; y < height; y++)
-				for (int x = from_x; x < to_x; x++)
-				{
-					assert(x < surface.width);
-					Color color = image.get_pixel_scaled(x, y, width, height).get_uint();
-					surface.memory[(y + pos_y) * surface.width + (x + pos_x)] = color;
-				}
-		});
+			Color c = image.get_pixel(x, y);
+			row[x * 3 + 0] = c.b;
+			row[x * 3 + 1] = c.g;
+			row[x * 3 + 2] = c.r;
+		}
+		fwrite(row.data(), 1, row_size, file);
+	}
+	return fclose(file) == 0;
+}
+
+// portable float map, channels 1 writes the red channel only, 3 writes rgb
+bool write_pfm(const char* path, fImage& image, int channels = 3)
+{
+	FILE* file = open_file(path, "wb");
+	if (!file) return false;
+
+	fprintf(file, "%s\n%d %d\n-1.0\n", channels == 1 ? "Pf" : "PF", image.width, image.height);	// negative scale, little endian
+
+	std::vector<float> row(image.width * channels);
+	for (int y = 0; y < image.height; y++)
+	{
+		for (int x = 0; x < image.width; x++)
+		{
+			fColor& c = image.get_pixel(x, y);
+			if (channels == 1)
+			{
+				row[x] = c.r;
+				continue;
+			}
+			row[x * 3 + 0] = c.r;
+			row[x * 3 + 1] = c.g;
+			row[x * 3 + 2] = c.b;
+		}
+		fwrite(row.data(), sizeof(float), row.size(), file);
+	}
+	return fclose(file) == 0;
+}
+
+
+struct Exr_channel
+{
+	const char* name;
+	const float* data;	// top row first
+	int stride;			// floats from one pixel to the next
+};
+
+// Minimal OpenEXR: uncompressed 32 bit float scanlines, one file with any number of named
+// channels, "layer.X" names group them into layers in compositing tools.
+bool write_exr(const char* path, int width, int height, std::vector<Exr_channel> channels)
+{
+	std::sort(channels.begin(), channels.end(), [](const Exr_channel& a, const Exr_channel& b) { return strcmp(a.name, b.name) < 0; });	// the format wants them sorted
+
+	std::vector<uint8_t> header;
+	auto put = [&header](const void* data, size_t size) { header.insert(header.end(), (const uint8_t*)data, (const uint8_t*)data + size); };
+	auto put32 = [&put](int32_t v) { put(&v, 4); };
+	auto put_str = [&put](const char* s) { put(s, strlen(s) + 1); };
+	auto attribute = [&](const char* name, const char* type, int32_t size) { put_str(name); put_str(type); put32(size); };
+
+	put32(20000630);	// magic
+	put32(2);			// version 2, single part scanlines
+
+	int32_t list_size = 1;
+	for (auto& channel : channels)
+		list_size += strlen(channel.name) + 1 + 16;
+	attribute("channels", "chlist", list_size);
+	for (auto& channel : channels)
+	{
+		put_str(channel.name);
+		put32(2);		// FLOAT
+		put32(0);		// pLinear and reserved
+		put32(1);		// x sampling
+		put32(1);		// y sampling
+	}
+	header.push_back(0);
+
+	attribute("compression", "compression", 1);
+	header.push_back(0);	// NO_COMPRESSION
+	int32_t window[4] = { 0, 0, width - 1, height - 1 };
+	attribute("dataWindow", "box2i", 16);
+	put(window, 16);
+	attribute("displayWindow", "box2i", 16);
+	put(window, 16);
+	attribute("lineOrder", "lineOrder", 1);
+	header.push_back(0);	// INCREASING_Y
+	float one = 1.0f, center[2] = { 0.0f, 0.0f };
+	attribute("pixelAspectRatio", "float", 4);
+	put(&one, 4);
+	attribute("screenWindowCenter", "v2f", 8);
+	put(center, 8);
+	attribute("screenWindowWidth", "float", 4);
+	put(&one, 4);
+	header.push_back(0);
+
+	// offset table, then every scanline as y, size and the channels one after the other
+	uint64_t line_size = (uint64_t)width * channels.size() * sizeof(float);
+	uint64_t offset = header.size() + (uint64_t)height * 8;
+	for (int y = 0; y < height; y++)
+	{
+		put(&offset, 8);
+		offset += 8 + line_size;
+	}
+
+	FILE* file = open_file(path, "wb");
+	if (!file) return false;
+	fwrite(header.data(), 1, header.size(), file);
+
+	std::vector<float> line(line_size / sizeof(float));
+	for (int y = 0; y < height; y++)
+	{
+		float* dst = line.data();
+		for (auto& channel : channels)
+			for (int x = 0; x < width; x++)
+				*dst++ = channel.data[((size_t)y * width + x) * channel.stride];
+
+		int32_t block[2] = { y, (int32_t)line_size };
+		fwrite(block, 4, 2, file);
+		fwrite(line.data(), 1, line_size, file);
 	}
+	return fclose(file) == 0;
+}
 
-	for (int i = 0; i < workers.size; i++)
-		res[i].get();
-}
\ No newline at end of file
+
+// false color from black over purple, red and yellow to white, t in [0, 1]
+Color heat_color(float t)
+{
+	static const float stops[][3] = { { 0, 0, 0 }, { 0.34f, 0.06f, 0.42f }, { 0.85f, 0.2f, 0.2f }, { 0.99f, 0.75f, 0.1f }, { 1, 1, 1 } };
+	const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+
+	t = max(0.0f, min(t, 1.0f)) * last;
+	int i = min((int)t, last - 1);
+	float f = t - i;
+	return Color((stops[i][0] + (stops[i + 1][0] - stops[i][0]) * f) * 255.0f,
+				 (stops[i][1] + (stops[i + 1][1] - stops[i][1]) * f) * 255.0f,
+				 (stops[i][2] + (stops[i + 1][2] - stops[i][2]) * f) * 255.0f);
+}
+
+// Maps the red channel of values to heat_color in out, which gets the same size. The scale tops out
+// at scale_max, or by default at the 99th percentile so a few outliers don't wash out the rest.
+// Returns the value that maps to white.
+float heatmap(fImage& values, Image& out, float scale_max = 0)
+{
+	int count = values.width * values.height;
+	if (out.width != values.width || out.height != values.height)
+		out = Image(values.width, values.height);
+	if (count == 0) return 0;
+
+	if (scale_max <= 0)
+	{
+		std::vector<float> sorted(count);
+		for (int i = 0; i < count; i++) sorted[i] = values[i].r;
+		std::nth_element(sorted.begin(), sorted.begin() + count * 99 / 100, sorted.end());
+		scale_max = max(sorted[count * 99 / 100], 1e-20f);
+	}
+
+	float inv = 1.0f / scale_max;
+	workers.parallel_for(0, count, 4096, [&values, &out, inv](size_t from, size_t to)
+	{
+		for (size_t i = from; i < to; i++)
+			out[i] = heat_color(values[i].r * inv);
+	});
+	return scale_max;
+}
@@ -3,48 +3,89 @@
 #define safe_release(ptr) (delete ptr, ptr = nullptr)
 #define safe_releaseArr(ptr) (delete[] ptr, ptr = nullptr)
 
+#ifdef _WIN32
+#include <winsock2.h>   // before Windows.h, which would bring the old winsock.h
 #include <Windows.h>
+#else
+#include <cstdarg>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#endif
 #include <stdio.h>
 #include <cstdint>
 #include <cstdio>
 
 #include <vector>
 #include <algorithm>
+#include <type_traits>
+
+#ifndef _WIN32
+// the min and max macros of Windows.h, the code calls them with mixed types
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+#endif
 
 
+// the debugger's output window on Windows, stderr elsewhere
 void doutput(const char* format, ...)
 {
-	char log[128];
 	va_list args;
 	va_start(args, format);
+#ifdef _WIN32
+	char log[128];
 	vsprintf_s(log, format, args);
 	OutputDebugStringA(log);
+#else
+	vfprintf(stderr, format, args);
+#endif
 	va_end(args);
 }
 
+// fopen without the /sdl deprecation error, NULL on failure
+FILE* open_file(const char* path, const char* mode)
+{
+#ifdef _WIN32
+	FILE* file = NULL;
+	if (fopen_s(&file, path, mode) != 0) return NULL;
+	return file;
+#else
+	return fopen(path, mode);
+#endif
+}
+
+#ifdef _WIN32
 #pragma comment(linker,"\"/manifestdependency:type='win32' \
 name='Microsoft.Windows.Common-Controls' version='6.0.0.0' \
 processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
+#endif
 
 
 #define STB_IMAGE_IMPLEMENTATION
+#ifdef _WIN32
 #define STBI_WINDOWS_UTF8
+#endif
 #include "stb_image.h"
 
 // globals
+#ifdef _WIN32
 HINSTANCE hInst;
-
-#ifndef MAX_THREADS
-#define MAX_THREADS 8
 #endif
 
 // unity build
+#include "profiler.cpp"
 #include "thread_pool.cpp"
-thread_pool workers(MAX_THREADS);
 
-// gui laoyt
+// the one executor for rendering, blitting and post processing, sized at runtime with workers.resize
+thread_pool workers;
+
+// gui laoyt, without a window outside Windows
 #include "canvas.cpp"
+#ifdef _WIN32
 #include "window.cpp"
+#endif
 #include "image.cpp"
 #include "draw.cpp"
 #include "input.cpp"
@@ -53,8 +94,15 @@ thread_pool workers(MAX_THREADS);
 
 
 
+#ifdef _WIN32
 void al_init(HINSTANCE hInstance)
 {
 	hInst = hInstance;
 	init_time = high_resolution_clock::now();
 }
+#else
+void al_init()
+{
+	init_time = high_resolution_clock::now();
+}
+#endif
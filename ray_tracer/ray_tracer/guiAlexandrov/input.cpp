@@ -20,7 +20,7 @@ struct Buttons
 
 struct Mouse_Input
 {
-	float pos_x, pos_y;
+	float pos_x = 0, pos_y = 0;
 	Buttons buttons[MOUSE_BUTTONS_COUNT];
 };
 
@@ -63,3 +63,147 @@ struct Key_Input
 };
 
 
+// changed and pressed only last for the frame the button went down or up in
+inline void set_button(Buttons& button, bool down)
+{
+	button.changed = button.is_down != down;
+	button.pressed = down && button.changed;
+	button.is_down = down;
+}
+
+// clears changed and pressed, once per frame after the input was used
+inline void end_input_frame(Key_Input& keys, Mouse_Input& mouse)
+{
+	for (Buttons& button : keys.buttons) button.changed = button.pressed = false;
+	for (Buttons& button : mouse.buttons) button.changed = button.pressed = false;
+}
+
+#ifdef _WIN32
+// updates keys and mouse from a window message, arrows and WASD are the same buttons,
+// returns false for messages that aren't input
+inline bool process_input(Key_Input& keys, Mouse_Input& mouse, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg)
+	{
+		case WM_KEYDOWN:
+		case WM_KEYUP:
+		{
+			bool down = msg == WM_KEYDOWN;
+			switch (wParam)
+			{
+				case VK_UP: case 'W': set_button(keys.buttons[BUTTON_UP], down); break;
+				case VK_DOWN: case 'S': set_button(keys.buttons[BUTTON_DOWN], down); break;
+				case VK_LEFT: case 'A': set_button(keys.buttons[BUTTON_LEFT], down); break;
+				case VK_RIGHT: case 'D': set_button(keys.buttons[BUTTON_RIGHT], down); break;
+				default: return false;
+			}
+		}return true;
+		case WM_MOUSEMOVE:
+		{
+			mouse.pos_x = (short)LOWORD(lParam);
+			mouse.pos_y = (short)HIWORD(lParam);
+		}return true;
+		case WM_LBUTTONDOWN: set_button(mouse.buttons[LBUTTON], true); return true;
+		case WM_LBUTTONUP: set_button(mouse.buttons[LBUTTON], false); return true;
+		case WM_RBUTTONDOWN: set_button(mouse.buttons[RBUTTON], true); return true;
+		case WM_RBUTTONUP: set_button(mouse.buttons[RBUTTON], false); return true;
+	}
+	return false;
+}
+#endif
+
+
+
+// scripted input
+
+struct Input_frame
+{
+	Key_Input keys;
+	Mouse_Input mouse;
+};
+
+// Input for driving a frame loop without a window, e.g. to time it. One step per line: the
+// number of frames, the held keys as up, down, left, right joined by '+' or '-' for none, and
+// optionally a left button drag in pixels per frame. '#' starts a comment.
+//
+//	30 up
+//	20 up+left
+//	15 - 4 -2
+struct Input_script
+{
+	std::vector<Input_frame> frames;
+
+	bool load(const char* path)
+	{
+		FILE* file = open_file(path, "rb");
+		if (!file) return false;
+
+		std::string text;
+		char chunk[4096];
+		for (size_t read; (read = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+			text.append(chunk, read);
+		fclose(file);
+		return parse(text.c_str());
+	}
+
+	// false on a malformed line, the steps before it are kept
+	bool parse(const char* text)
+	{
+		Mouse_Input mouse;
+		while (*text)
+		{
+			const char* end = text + strcspn(text, "\n");
+			std::string line(text, end);
+			text = *end ? end + 1 : end;
+
+			line = line.substr(0, line.find('#'));
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+			char* pos;
+			long count = strtol(line.c_str(), &pos, 10);
+			if (pos == line.c_str() || count < 0) return false;
+
+			while (*pos == ' ' || *pos == '\t') pos++;
+			const char* keys_begin = pos;
+			while (*pos && *pos != ' ' && *pos != '\t' && *pos != '\r') pos++;
+			std::string held(keys_begin, pos - keys_begin);
+
+			Key_Input keys;
+			if (held != "-")
+			{
+				for (size_t begin = 0; begin <= held.size();)
+				{
+					size_t plus = held.find('+', begin);
+					std::string key = held.substr(begin, plus == std::string::npos ? std::string::npos : plus - begin);
+					if (key == "up") keys.buttons[BUTTON_UP].is_down = true;
+					else if (key == "down") keys.buttons[BUTTON_DOWN].is_down = true;
+					else if (key == "left") keys.buttons[BUTTON_LEFT].is_down = true;
+					else if (key == "right") keys.buttons[BUTTON_RIGHT].is_down = true;
+					else return false;
+					if (plus == std::string::npos) break;
+					begin = plus + 1;
+				}
+			}
+
+			char* drag_end;
+			float drag_x = strtof(pos, &drag_end);
+			bool drag = drag_end != pos;
+			float drag_y = drag ? strtof(drag_end, &drag_end) : 0.0f;
+
+			for (long i = 0; i < count; i++)
+			{
+				Input_frame frame;
+				frame.keys = keys;
+				set_button(mouse.buttons[LBUTTON], drag);
+				if (drag && i > 0)
+				{
+					mouse.pos_x += drag_x;
+					mouse.pos_y += drag_y;
+				}
+				frame.mouse = mouse;
+				frames.push_back(frame);
+			}
+		}
+		return true;
+	}
+};
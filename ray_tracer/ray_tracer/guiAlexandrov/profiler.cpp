@@ -0,0 +1,143 @@
+// Scoped zone profiler, compiled in only with PROFILER defined.
+//
+//	PROFILE_ZONE("render");            // measures until the end of the scope
+//	profiler.write_chrome_trace("trace.json");  // open in chrome://tracing or ui.perfetto.dev
+//
+// Every thread writes finished zones into a ring buffer of its own, so recording takes no locks
+// and the oldest zones are overwritten when a buffer is full. Nesting comes from the timestamps.
+
+#ifdef PROFILER
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+#ifndef PROFILER_EVENTS
+#define PROFILER_EVENTS (1 << 16)	// per thread, power of two
+#endif
+
+
+struct Profile_event
+{
+	const char* name;	// string literal, only the pointer is stored
+	uint64_t start_ns;
+	uint64_t end_ns;
+	int depth;
+};
+
+
+struct Profile_thread
+{
+	Profile_event events[PROFILER_EVENTS];
+	std::atomic<uint64_t> written{0};
+	int id;
+	int depth = 0;
+
+	void push(const Profile_event& event)
+	{
+		uint64_t idx = written.load(std::memory_order_relaxed);
+		events[idx & (PROFILER_EVENTS - 1)] = event;
+		written.store(idx + 1, std::memory_order_release);
+	}
+};
+
+
+struct Profiler
+{
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Profile_thread>> threads;	// outlive their threads so pool resizes keep the history
+
+	uint64_t now_ns() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	Profile_thread& local()
+	{
+		thread_local Profile_thread* buffer = nullptr;
+		if (!buffer)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			threads.emplace_back(new Profile_thread());
+			buffer = threads.back().get();
+			buffer->id = threads.size() - 1;
+		}
+		return *buffer;
+	}
+
+	// drops the recorded zones, call while nothing is being measured
+	void clear()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (auto& thread : threads)
+			thread->written = 0;
+	}
+
+	// Chrome trace event format, one complete event per zone, times in microseconds.
+	// Call while nothing is being measured, zones still running on other threads may be torn.
+	bool write_chrome_trace(const char* path)
+	{
+		FILE* file = open_file(path, "wb");
+		if (!file) return false;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+
+		for (auto& thread : threads)
+		{
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+				first ? "" : ",\n", thread->id, thread->id);
+			first = false;
+
+			uint64_t written = thread->written.load(std::memory_order_acquire);
+			uint64_t begin = written > PROFILER_EVENTS ? written - PROFILER_EVENTS : 0;
+			for (uint64_t i = begin; i < written; i++)
+			{
+				const Profile_event& event = thread->events[i & (PROFILER_EVENTS - 1)];
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%d}}",
+					event.name, thread->id, event.start_ns * 1e-3, (event.end_ns - event.start_ns) * 1e-3, event.depth);
+			}
+		}
+
+		fprintf(file, "\n]}\n");
+		return fclose(file) == 0;
+	}
+};
+
+Profiler profiler;
+
+
+struct Profile_zone
+{
+	Profile_thread& thread;
+	const char* name;
+	uint64_t start_ns;
+
+	Profile_zone(const char* name) : thread(profiler.local()), name(name)
+	{
+		thread.depth++;
+		start_ns = profiler.now_ns();
+	}
+
+	~Profile_zone()
+	{
+		thread.depth--;
+		thread.push({ name, start_ns, profiler.now_ns(), thread.depth });
+	}
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) Profile_zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+#else
+
+#define PROFILE_ZONE(name)
+
+#endif
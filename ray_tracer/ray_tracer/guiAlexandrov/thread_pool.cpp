@@ -1,4 +1,3 @@
-
 #include <cmath>
 #include <thread>
 #include <vector>
@@ -7,66 +6,507 @@
 #include <functional>
 #include <queue>
 #include <future>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #define MIN(a, b) (a < b ? a : b)
 
+
+// move only void() callable, small ones are stored inline and don't touch the heap
+struct task
+{
+	static const size_t inline_size = 48;
+
+	alignas(std::max_align_t) unsigned char storage[inline_size];
+	void (*invoke)(void*) = nullptr;
+	void (*relocate)(void* from, void* to) = nullptr;  // move constructs into to and destroys from
+	void (*destroy)(void*) = nullptr;
+
+	task() = default;
+
+	template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, task>::value>::type>
+	task(F&& f)
+	{
+		typedef typename std::decay<F>::type Fn;
+
+		if (sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t))
+		{
+			new (storage) Fn(std::forward<F>(f));
+			invoke = [](void* p) { (*(Fn*)p)(); };
+			relocate = [](void* from, void* to) { new (to) Fn(std::move(*(Fn*)from)); ((Fn*)from)->~Fn(); };
+			destroy = [](void* p) { ((Fn*)p)->~Fn(); };
+		}
+		else
+		{
+			*(Fn**)storage = new Fn(std::forward<F>(f));
+			invoke = [](void* p) { (**(Fn**)p)(); };
+			relocate = [](void* from, void* to) { *(Fn**)to = *(Fn**)from; };
+			destroy = [](void* p) { delete *(Fn**)p; };
+		}
+	}
+
+	task(task&& other) { take(other); }
+
+	task& operator = (task&& other)
+	{
+		if (this != &other)
+		{
+			reset();
+			take(other);
+		}
+		return *this;
+	}
+
+	task(const task&) = delete;
+	task& operator = (const task&) = delete;
+
+	~task() { reset(); }
+
+	void operator () () { invoke(storage); }
+	explicit operator bool () const { return invoke != nullptr; }
+
+private:
+
+	void take(task& other)
+	{
+		if (!other.invoke) return;
+		other.relocate(other.storage, storage);
+		invoke = other.invoke;
+		relocate = other.relocate;
+		destroy = other.destroy;
+		other.invoke = nullptr;
+	}
+
+	void reset()
+	{
+		if (invoke) destroy(storage);
+		invoke = nullptr;
+	}
+};
+
+
+// FIFO ring buffer, only grows so a warmed up pool doesn't allocate per task
+struct task_queue
+{
+	std::vector<task> buffer;
+	size_t head = 0;
+	size_t count = 0;
+
+	bool empty() const { return count == 0; }
+
+	void reserve(size_t n)
+	{
+		if (n <= buffer.size()) return;
+
+		size_t capacity = std::max<size_t>(64, buffer.size());
+		while (capacity < n) capacity *= 2;
+
+		std::vector<task> grown(capacity);
+		for (size_t i = 0; i < count; i++)
+			grown[i] = std::move(buffer[(head + i) % buffer.size()]);
+		buffer.swap(grown);
+		head = 0;
+	}
+
+	void push(task&& t)
+	{
+		reserve(count + 1);
+		buffer[(head + count) % buffer.size()] = std::move(t);
+		count++;
+	}
+
+	task pop()
+	{
+		task t = std::move(buffer[head]);
+		head = (head + 1) % buffer.size();
+		count--;
+		return t;
+	}
+};
+
+
+// queued tasks of a higher priority always start first, FIFO within one priority
+enum task_priority
+{
+	PRIORITY_LOW,
+	PRIORITY_NORMAL,
+	PRIORITY_HIGH,
+	PRIORITY_COUNT
+};
+
+
+// one logical processor and the NUMA node it belongs to
+struct cpu_slot
+{
+#ifdef _WIN32
+	GROUP_AFFINITY affinity;
+#else
+	int cpu;
+#endif
+	int node;   // dense index in enumeration order, nodes without processors are skipped
+};
+
+#ifdef _WIN32
+// all logical processors ordered node by node
+std::vector<cpu_slot> cpu_slots()
+{
+	std::vector<cpu_slot> slots;
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest)) highest = 0;
+
+	int node_index = 0;
+	for (ULONG node = 0; node <= highest; node++)
+	{
+		GROUP_AFFINITY mask = {};
+		if (!GetNumaNodeProcessorMaskEx((USHORT)node, &mask) || mask.Mask == 0) continue;
+
+		for (int bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+		{
+			if (!(mask.Mask & ((KAFFINITY)1 << bit))) continue;
+			cpu_slot slot = {};
+			slot.affinity.Group = mask.Group;
+			slot.affinity.Mask = (KAFFINITY)1 << bit;
+			slot.node = node_index;
+			slots.push_back(slot);
+		}
+		node_index++;
+	}
+	return slots;
+}
+
+void pin_current_thread(const cpu_slot& slot)
+{
+	SetThreadGroupAffinity(GetCurrentThread(), &slot.affinity, NULL);
+}
+#elif defined(__linux__)
+// the processors this process may run on ordered node by node, the nodes come from
+// /sys/devices/system/node and without it all of them are node 0
+std::vector<cpu_slot> cpu_slots()
+{
+	std::vector<cpu_slot> slots;
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return slots;
+
+	std::vector<bool> taken(CPU_SETSIZE, false);
+	int node_index = 0;
+	for (int node = 0; node < 1024; node++)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE* file = fopen(path, "rb");
+		if (!file) continue;
+
+		// "0-3,8-11"
+		bool any = false;
+		int first, last;
+		while (fscanf(file, "%d", &first) == 1)
+		{
+			last = first;
+			int c = fgetc(file);
+			if (c == '-' && fscanf(file, "%d", &last) == 1) c = fgetc(file);
+			for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			{
+				if (!CPU_ISSET(cpu, &allowed) || taken[cpu]) continue;
+				cpu_slot slot = {};
+				slot.cpu = cpu;
+				slot.node = node_index;
+				slots.push_back(slot);
+				taken[cpu] = any = true;
+			}
+			if (c != ',') break;
+		}
+		fclose(file);
+		if (any) node_index++;
+	}
+
+	// processors no node listed
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &allowed) || taken[cpu]) continue;
+		cpu_slot slot = {};
+		slot.cpu = cpu;
+		slot.node = 0;
+		slots.push_back(slot);
+	}
+	return slots;
+}
+
+void pin_current_thread(const cpu_slot& slot)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(slot.cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+#else
+// no affinity here, -pin leaves the workers unpinned
+std::vector<cpu_slot> cpu_slots()
+{
+	return std::vector<cpu_slot>();
+}
+
+void pin_current_thread(const cpu_slot& slot)
+{
+}
+#endif
+
+
 struct thread_pool
 {
 	size_t size;
 	std::vector<std::thread> pool;
-	std::queue<std::function<void()>> tasks;
+	task_queue tasks[PRIORITY_COUNT];
 	std::condition_variable event;
 	std::mutex event_mutex;
 	bool stopping;
 
+	// with pinned workers parallel loops are split into one band per node
+	bool pinned = false;
+	int nodes = 1;
 
+	// node of the calling thread, threads that aren't pinned workers count as node 0
+	static int& current_node()
+	{
+		thread_local int node = 0;
+		return node;
+	}
 
-	thread_pool(size_t threads = 8)
+
+	// 0 threads means one per core minus the caller, which works on its own parallel loops.
+	// pin locks every worker to one logical processor, filling the NUMA nodes in order.
+	thread_pool(size_t threads = 0, bool pin = false)
 	{
-		size = MIN(std::thread::hardware_concurrency(), threads);
-		stopping = false;
-		start();
+		start(threads, pin);
 	}
 
 	~thread_pool() { stop(); }
 
+	// a pool without workers: parallel loops run on the caller alone and queued tasks
+	// wait for a resize, e.g. for the single thread row of a scaling benchmark
+	static const size_t no_workers = (size_t)-1;
+
+	static size_t default_size()
+	{
+		size_t cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 1;
+	}
+
+	// finishes the queued tasks and restarts with the new number of threads
+	void resize(size_t threads, bool pin = false)
+	{
+		stop();
+		pool.clear();
+		start(threads, pin);
+	}
+
+	template <typename T>
+	auto add_task(T fn)->std::future<decltype(fn())>
+	{
+		// the shared state of the future is the only allocation, the wrapper fits inline
+		auto wrapper = std::make_shared<std::packaged_task<decltype(fn()) ()>>(std::move(fn));
+		auto future = wrapper->get_future();
+		{
+			std::unique_lock<std::mutex> lock(event_mutex);
+			tasks[PRIORITY_NORMAL].push([wrapper]() { (*wrapper)(); });
+		}
+		event.notify_one();
+		return future;
+	}
+
+	// fire and forget, no future and no allocation if the callable fits inline
 	template <typename T>
-	auto add_task(T task)->std::future<decltype(task())>
+	void add_job(T&& job, task_priority priority = PRIORITY_NORMAL)
 	{
-		auto wrapper = std::make_shared<std::packaged_task<decltype(task()) ()>>(std::move(task));
 		{
 			std::unique_lock<std::mutex> lock(event_mutex);
-			tasks.push([=]() { (*wrapper)(); });
+			tasks[priority].push(std::forward<T>(job));
 		}
 		event.notify_one();
-		return wrapper->get_future();
+	}
+
+	// enqueues job(0) ... job(count - 1) under one lock and wakes the workers once
+	template <typename T>
+	void add_tasks(size_t count, const T& job, task_priority priority = PRIORITY_NORMAL)
+	{
+		if (count == 0) return;
+		{
+			std::unique_lock<std::mutex> lock(event_mutex);
+			task_queue& queue = tasks[priority];
+			queue.reserve(queue.count + count);
+			for (size_t i = 0; i < count; i++)
+				queue.push([job, i]() { job(i); });
+		}
+		if (count == 1) event.notify_one();
+		else event.notify_all();
+	}
+
+	// runs one queued task on the calling thread, false if the queue is empty
+	bool try_run_one()
+	{
+		task current;
+		{
+			std::unique_lock<std::mutex> lock(event_mutex);
+			if (!has_tasks()) return false;
+			current = pop_task();
+		}
+		current();
+		return true;
+	}
+
+	// Calls job(from, to) over [begin, end) in chunks of grain. Chunks are handed out dynamically
+	// to the workers and to the calling thread, so it is safe to call from inside a task.
+	// The range is cut into one contiguous band per node, threads drain their own node's band
+	// before stealing from the others, so the same range always lands on the same node.
+	template <typename T>
+	void parallel_for(size_t begin, size_t end, size_t grain, const T& job)
+	{
+		if (begin >= end) return;
+		grain = grain ? grain : 1;
+		size_t chunks = (end - begin + grain - 1) / grain;
+
+		struct band
+		{
+			std::atomic<size_t> next;
+			size_t end;
+		};
+
+		struct state
+		{
+			std::unique_ptr<band[]> bands;
+			int band_count;
+			std::atomic<size_t> remaining;
+			size_t grain;
+			T job;
+			std::mutex done_mutex;
+			std::condition_variable done;
+
+			state(size_t begin, size_t end, size_t grain, size_t chunks, int nodes, const T& job) :
+				bands(new band[nodes]), band_count(nodes), remaining(chunks), grain(grain), job(job)
+			{
+				for (int n = 0; n < nodes; n++)
+				{
+					bands[n].next = begin + chunks * n / nodes * grain;
+					bands[n].end = MIN(begin + chunks * (n + 1) / nodes * grain, end);
+				}
+			}
+
+			bool run_chunk(int home)
+			{
+				for (int i = 0; i < band_count; i++)
+				{
+					band& b = bands[(home + i) % band_count];
+					if (b.next >= b.end) continue;
+					size_t from = b.next.fetch_add(grain);
+					if (from >= b.end) continue;
+
+					job(from, MIN(from + grain, b.end));
+					if (--remaining == 0)
+					{
+						std::unique_lock<std::mutex> lock(done_mutex);
+						done.notify_all();
+					}
+					return true;
+				}
+				return false;
+			}
+		};
+
+		// helpers that start after all chunks are taken find nothing to do and just drop their reference
+		int bands = (int)MIN((size_t)nodes, chunks);
+		auto shared = std::make_shared<state>(begin, end, grain, chunks, bands, job);
+		add_tasks(MIN(size, chunks - 1), [shared](size_t) { while (shared->run_chunk(current_node() % shared->band_count)); });
+
+		while (shared->run_chunk(current_node() % bands));
+
+		// the chunks still running were claimed by started threads, no need to help
+		std::unique_lock<std::mutex> lock(shared->done_mutex);
+		shared->done.wait(lock, [&]() { return shared->remaining == 0; });
+	}
+
+	// job(x0, y0, x1, y1) for every tile_w x tile_h tile of the rectangle [x0, x1) x [y0, y1)
+	template <typename T>
+	void parallel_for_2d(int x0, int y0, int x1, int y1, int tile_w, int tile_h, const T& job)
+	{
+		if (x0 >= x1 || y0 >= y1) return;
+		tile_w = tile_w > 0 ? tile_w : 1;
+		tile_h = tile_h > 0 ? tile_h : 1;
+		int tiles_x = (x1 - x0 + tile_w - 1) / tile_w;
+		int tiles_y = (y1 - y0 + tile_h - 1) / tile_h;
+
+		parallel_for(0, tiles_x * tiles_y, 1, [=](size_t from, size_t to)
+		{
+			for (size_t tile = from; tile < to; tile++)
+			{
+				int tx = x0 + (tile % tiles_x) * tile_w;
+				int ty = y0 + (tile / tiles_x) * tile_h;
+				job(tx, ty, MIN(tx + tile_w, x1), MIN(ty + tile_h, y1));
+			}
+		});
 	}
 
 private:
 
-	void start()
+	void start(size_t threads, bool pin)
 	{
-		for (int i = 0; i < size; i++)
+		size = threads == no_workers ? 0 : threads ? threads : default_size();
+		stopping = false;
+
+		std::vector<cpu_slot> slots;
+		if (pin) slots = cpu_slots();
+		pinned = !slots.empty();
+
+		nodes = 1;
+		for (size_t i = 0; i < size && pinned; i++)
+			if (slots[i % slots.size()].node >= nodes) nodes = slots[i % slots.size()].node + 1;
+
+		for (size_t i = 0; i < size; i++)
 		{
-			pool.push_back(std::thread([&]() {
+			cpu_slot slot = pinned ? slots[i % slots.size()] : cpu_slot();
+			pool.push_back(std::thread([this, slot]() {
+				if (pinned)
+				{
+					pin_current_thread(slot);
+					current_node() = slot.node;
+				}
+
 				while (true)
 				{
-					std::function<void()> task;
+					task current;
 					{
 						std::unique_lock<std::mutex> lock(event_mutex);
 
-						event.wait(lock, [&]() { return stopping || !tasks.empty(); });
-						if (stopping && tasks.empty()) break;
+						event.wait(lock, [&]() { return stopping || has_tasks(); });
+						if (stopping && !has_tasks()) break;
 
-						task = std::move(tasks.front());
-						tasks.pop();
+						current = pop_task();
 					}
-					task();
+					current();
 				}
 			}));
 		}
 	}
 
+	// both under event_mutex
+	bool has_tasks() const
+	{
+		for (const task_queue& queue : tasks)
+			if (!queue.empty()) return true;
+		return false;
+	}
+
+	task pop_task()
+	{
+		for (int priority = PRIORITY_COUNT - 1; priority > 0; priority--)
+			if (!tasks[priority].empty()) return tasks[priority].pop();
+		return tasks[0].pop();
+	}
+
 	void stop() noexcept
 	{
 		{
@@ -80,3 +520,49 @@ private:
 			thread.join();
 	}
 };
+
+
+// Set of tasks that can be waited on or cancelled together. Waiting runs queued
+// tasks on the calling thread, so groups can be nested inside pool tasks.
+struct task_group
+{
+	thread_pool& pool;
+	std::atomic<int> pending{0};
+	std::atomic<bool> cancelled{false};
+	std::mutex done_mutex;
+	std::condition_variable done;
+
+	task_group(thread_pool& pool) : pool(pool) {}
+	~task_group() { wait(); }
+
+	template <typename T>
+	void run(T&& job, task_priority priority = PRIORITY_NORMAL)
+	{
+		pending++;
+		pool.add_job([this, job]()
+		{
+			if (!cancelled) job();
+
+			std::unique_lock<std::mutex> lock(done_mutex);
+			if (--pending == 0) done.notify_all();
+		}, priority);
+	}
+
+	// tasks that haven't started yet are skipped, running ones finish
+	void cancel() { cancelled = true; }
+	bool is_cancelled() const { return cancelled; }
+
+	void wait()
+	{
+		while (pending > 0)
+		{
+			if (pool.try_run_one()) continue;
+
+			std::unique_lock<std::mutex> lock(done_mutex);
+			done.wait_for(lock, std::chrono::milliseconds(1), [&]() { return pending == 0; });
+		}
+
+		// the last task may still hold the mutex after the count reached zero
+		std::unique_lock<std::mutex> lock(done_mutex);
+	}
+};
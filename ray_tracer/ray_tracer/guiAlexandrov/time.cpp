@@ -21,7 +21,7 @@ struct Time
 
 	~Time()
 	{
-		float elapsed = init_time - get_time();
+		float elapsed = get_time() - init_time;
 		doutput("%f\n", elapsed);
 	}
 };
@@ -0,0 +1,99 @@
+// The frame loop of the viewer, without the window so a script can drive it too: input moves the
+// camera, every frame renders settings.samples per pixel and is accumulated over time.
+
+struct Interactive_settings
+{
+    float move_speed = 4.0f;       // scene units per second
+    float turn_speed = 1.5f;       // radians per second for left and right
+    float drag_speed = 0.005f;     // radians per pixel the mouse is dragged with the left button
+    bool temporal = true;          // reproject and accumulate, otherwise every frame stands alone
+    Temporal_settings history;
+};
+
+struct Frame_loop
+{
+    const Scene& scene;
+    Render_settings settings;
+    Interactive_settings interactive;
+
+    fImage hdr;
+    Aov_buffers aovs;
+    Temporal_accumulator accumulator;
+    int frames = 0;
+
+    bool dragging = false;
+    float drag_x = 0, drag_y = 0;   // mouse position at the last frame of the drag
+
+    Frame_loop(const Scene& scene, const Render_settings& settings, int width, int height,
+               const Interactive_settings& interactive = Interactive_settings()) :
+        scene(scene), settings(settings), interactive(interactive), hdr(width, height)
+    {
+        // the frames are accumulated, so even one sample per pixel has to be jittered
+        this->settings.jitter = interactive.temporal;
+        aovs.resize(width, height, interactive.temporal ? AOV_DEPTH : 0);
+        accumulator.settings = interactive.history;
+        accumulator.resize(width, height);
+        // render() only writes settings.crop, the rest of the frame stays black
+        if (!settings.crop.empty()) std::fill(hdr.data, hdr.data + (size_t)width * height, fColor(0.0f, 0.0f, 0.0f));
+    }
+
+    // up and down move along the view, left and right turn, a left button drag looks around;
+    // true if the camera moved
+    bool update_camera(const Key_Input& keys, const Mouse_Input& mouse, float dt)
+    {
+        Camera& camera = settings.camera;
+        Camera before = camera;
+
+        float yaw = camera.yaw + (keys.buttons[BUTTON_LEFT].is_down - keys.buttons[BUTTON_RIGHT].is_down) * interactive.turn_speed * dt;
+        float pitch = camera.pitch;
+        float move = (keys.buttons[BUTTON_UP].is_down - keys.buttons[BUTTON_DOWN].is_down) * interactive.move_speed * dt;
+
+        const Buttons& drag = mouse.buttons[LBUTTON];
+        if (drag.is_down && dragging)
+        {
+            yaw -= (mouse.pos_x - drag_x) * interactive.drag_speed;
+            pitch -= (mouse.pos_y - drag_y) * interactive.drag_speed;
+            pitch = max(-1.5f, min(1.5f, pitch));
+        }
+        if (yaw != camera.yaw || pitch != camera.pitch) camera.turn(yaw, pitch);
+        camera.position = camera.position + camera.forward * move;
+        dragging = drag.is_down;
+        drag_x = mouse.pos_x;
+        drag_y = mouse.pos_y;
+
+        return camera != before;
+    }
+
+    // renders the next frame into screen, rows top first
+    void frame(const Key_Input& keys, const Mouse_Input& mouse, float dt, Image& screen)
+    {
+        PROFILE_ZONE("frame");
+        update_camera(keys, mouse, dt);
+        // every frame continues the samples of the last one, the same jitter would be accumulated otherwise
+        settings.first_sample = frames * max(settings.samples, 1);
+        frames++;
+
+        render(hdr, scene, settings, NULL, &aovs);
+        if (!interactive.temporal)
+        {
+            tonemap(hdr, screen, settings.tonemap);
+            return;
+        }
+        const fImage& accumulated = accumulator.accumulate(hdr, aovs.depth, settings.camera, max(settings.samples, 1));
+        tonemap(accumulated, screen, settings.tonemap);
+    }
+};
+
+// Frame times in seconds of a scripted run, every frame advances the script by dt.
+std::vector<double> run_script(Frame_loop& loop, const Input_script& script, Image& screen, float dt = 1.0f / 30.0f)
+{
+    std::vector<double> times;
+    times.reserve(script.frames.size());
+    for (const Input_frame& input : script.frames)
+    {
+        auto start = high_resolution_clock::now();
+        loop.frame(input.keys, input.mouse, dt, screen);
+        times.push_back(duration<double>(high_resolution_clock::now() - start).count());
+    }
+    return times;
+}
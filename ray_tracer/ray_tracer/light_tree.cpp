@@ -0,0 +1,150 @@
+struct Light
+{
+    vec3f position;
+    float intensity;
+    Light(const vec3f& p, const float& i) : position(p), intensity(i) {}
+};
+
+
+struct Light_node
+{
+    vec3f bb_min, bb_max;
+    float power;
+    int left, right;   // children, left < 0 for a leaf
+    int light;         // light index for a leaf
+};
+
+
+// Binary hierarchy over the scene lights. Every node bounds the position and the total
+// intensity of its lights, so whole subtrees can be culled or sampled at once.
+struct Light_tree
+{
+    std::vector<Light> lights;
+    std::vector<Light_node> nodes;
+
+    void build(const std::vector<Light>& scene_lights)
+    {
+        lights = scene_lights;
+        nodes.clear();
+        if (lights.empty()) return;
+
+        nodes.reserve(lights.size() * 2);
+        build_node(0, lights.size());
+    }
+
+    // upper bound of intensity * cos(N, light_dir) over the node box, 0 when the box is behind the surface
+    float importance(const Light_node& node, const vec3f& point, const vec3f& N) const
+    {
+        vec3f center = (node.bb_min + node.bb_max) * 0.5f;
+        vec3f extent = (node.bb_max - node.bb_min) * 0.5f;
+
+        float max_dot = (center - point) * N + fabsf(N.x) * extent.x + fabsf(N.y) * extent.y + fabsf(N.z) * extent.z;
+        if (max_dot <= 0) return 0;
+
+        vec3f d = vec3f(max(0.f, max(node.bb_min.x - point.x, point.x - node.bb_max.x)),
+                        max(0.f, max(node.bb_min.y - point.y, point.y - node.bb_max.y)),
+                        max(0.f, max(node.bb_min.z - point.z, point.z - node.bb_max.z)));
+        float min_dist = d.norm();
+        float cos_bound = min_dist > 0 ? min(1.f, max_dot / min_dist) : 1.f;
+        return node.power * cos_bound;
+    }
+
+    // calls visit(light_index) for every light whose bounded contribution at the point is above cutoff
+    template <typename F>
+    void for_each(const vec3f& point, const vec3f& N, float cutoff, F visit) const
+    {
+        if (nodes.empty()) return;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top)
+        {
+            const Light_node& node = nodes[stack[--top]];
+            RAY_STAT(light_nodes, 1);
+            if (importance(node, point, N) <= cutoff) continue;
+
+            if (node.left < 0)
+            {
+                visit(node.light);
+                continue;
+            }
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
+    }
+
+    // picks one light index proportionally to its importance bound, pdf is the probability of the pick
+    int sample(const vec3f& point, const vec3f& N, float u, float& pdf) const
+    {
+        pdf = 1.0f;
+        if (nodes.empty()) return -1;
+
+        const Light_node* node = &nodes[0];
+        if (importance(*node, point, N) <= 0) return -1;
+
+        while (node->left >= 0)
+        {
+            RAY_STAT(light_nodes, 2);
+            float w_left = importance(nodes[node->left], point, N);
+            float w_right = importance(nodes[node->right], point, N);
+            if (w_left + w_right <= 0) return -1;   // the parent box grazes the surface, both children are behind it
+            float p_left = w_left / (w_left + w_right);
+
+            if (u < p_left)
+            {
+                u = u / p_left;
+                pdf *= p_left;
+                node = &nodes[node->left];
+            }
+            else
+            {
+                u = (u - p_left) / (1.0f - p_left);
+                pdf *= 1.0f - p_left;
+                node = &nodes[node->right];
+            }
+        }
+        return node->light;
+    }
+
+private:
+
+    int build_node(size_t from, size_t to)
+    {
+        int idx = nodes.size();
+        nodes.push_back(Light_node());
+
+        Light_node node;
+        node.bb_min = lights[from].position;
+        node.bb_max = lights[from].position;
+        node.power = 0;
+        for (size_t i = from; i < to; i++)
+        {
+            const vec3f& p = lights[i].position;
+            node.bb_min = vec3f(min(node.bb_min.x, p.x), min(node.bb_min.y, p.y), min(node.bb_min.z, p.z));
+            node.bb_max = vec3f(max(node.bb_max.x, p.x), max(node.bb_max.y, p.y), max(node.bb_max.z, p.z));
+            node.power += lights[i].intensity;
+        }
+
+        if (to - from == 1)
+        {
+            node.left = node.right = -1;
+            node.light = from;
+            nodes[idx] = node;
+            return idx;
+        }
+
+        vec3f size = node.bb_max - node.bb_min;
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        size_t mid = (from + to) / 2;
+        std::nth_element(lights.begin() + from, lights.begin() + mid, lights.begin() + to,
+            [axis](const Light& a, const Light& b) { return a.position.raw[axis] < b.position.raw[axis]; });
+
+        node.light = -1;
+        node.left = build_node(from, mid);
+        node.right = build_node(mid, to);
+        nodes[idx] = node;
+        return idx;
+    }
+};
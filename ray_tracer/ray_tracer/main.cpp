@@ -1,32 +1,284 @@
 
-#define MAX_THREADS 2
-#include "guiAlexandrov/include.h"
+#include "tracer.h"
 
+#include <numeric>
 
-#define PI 3.14159265359f
-#include "geometry.cpp"
-#include "ray_caster.cpp"
 
-
-void up_side_dawn(Image& img)
+template <typename Img>
+void up_side_dawn(Img& img)
 {
+	PROFILE_ZONE("flip");
 	for (int y = 0; y < img.height / 2; y++)
 		for (int x = 0; x < img.width; x++)
 			std::swap(img.get_pixel(x, y), img.get_pixel(x, img.height - y - 1));
 }
 
+typedef std::vector<std::string> Args;
+
+// the command line split at spaces, double quotes keep a path with spaces in one argument
+Args split_args(const char* cmd)
+{
+	Args args;
+	for (const char* c = cmd ? cmd : ""; *c;)
+	{
+		if (*c == ' ' || *c == '\t')
+		{
+			c++;
+			continue;
+		}
+
+		std::string arg;
+		bool quoted = false;
+		for (; *c && (quoted || (*c != ' ' && *c != '\t')); c++)
+		{
+			if (*c == '"') quoted = !quoted;
+			else arg += *c;
+		}
+		args.push_back(arg);
+	}
+	return args;
+}
+
+// the parts of a comma separated list like "a,b,c"
+std::vector<std::string> split_list(const std::string& list)
+{
+	std::vector<std::string> parts;
+	for (size_t begin = 0; begin < list.size();)
+	{
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos) end = list.size();
+		parts.push_back(list.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return parts;
+}
+
+// whether the flag "-name" is on the command line, as a whole argument
+bool has_arg(const Args& args, const char* name)
+{
+	return std::find(args.begin(), args.end(), name) != args.end();
+}
+
+// value of "-name text" on the command line, empty if it isn't there
+std::string arg_str(const Args& args, const char* name)
+{
+	Args::const_iterator found = std::find(args.begin(), args.end(), name);
+	return found != args.end() && found + 1 != args.end() ? *(found + 1) : std::string();
+}
+
+// value of "-name N" on the command line, def if it isn't there
+int arg_int(const Args& args, const char* name, int def)
+{
+	std::string value = arg_str(args, name);
+	return value.empty() ? def : atoi(value.c_str());
+}
+
+// prints how long the frames of a scripted or relit run took to stdout, which a redirect
+// captures from the Windows build as well
+void print_frame_times(std::vector<double> times)
+{
+	if (times.empty()) return;
+	std::sort(times.begin(), times.end());
+	double total = std::accumulate(times.begin(), times.end(), 0.0);
+	printf("%d frames, %.2f ms average, %.2f ms median, %.2f ms p95\n", (int)times.size(), total * 1e3 / times.size(),
+		   times[times.size() / 2] * 1e3, times[(times.size() * 95) / 100] * 1e3);
+	fflush(stdout);
+}
+
+// -trace file.json writes the zones of the whole session on exit
+#ifdef PROFILER
+void write_trace(const Args& args)
+{
+	std::string trace = arg_str(args, "-trace");
+	if (!trace.empty() && !profiler.write_chrome_trace(trace.c_str()))
+		doutput("can't write %s\n", trace.c_str());
+}
+#else
+inline void write_trace(const Args&) {}
+#endif
+
+// the window's input, read by the interactive loop
+Key_Input keys;
+Mouse_Input mouse;
+bool running = true;
+
+#ifdef _WIN32
 int WINAPI WinMain(HINSTANCE hInst, HINSTANCE lool, LPSTR cmdLine, int show)
 {
 	al_init(hInst);
+	Args args = split_args(cmdLine);
+#else
+// the same options without a window, -image saves the frame
+int main(int argc, char** argv)
+{
+	al_init();
+	Args args(argv + 1, argv + argc);
+#endif
+
+	// -worker PORT renders tiles for the -distributed coordinator listening on PORT, -scene names the scene
+	int worker_port = arg_int(args, "-worker", 0);
+	std::string scene_name = arg_str(args, "-scene");
+	if (worker_port > 0) return run_worker(worker_port, scene_name);
+
+	// -threads N, by default one worker per core besides this thread, -pin locks them to cores node by node
+	int threads = arg_int(args, "-threads", 0);
+	bool pin = has_arg(args, "-pin");
+	if (threads > 0 || pin) workers.resize(threads, pin);
 
 	Image screen(800, 600);
+	fImage hdr(screen.width, screen.height);
+	first_touch(screen, Render_settings().tile_size);
+	first_touch(hdr, Render_settings().tile_size);
+
+
+	// ray tracer
+	Scene scene;
+	{
+		PROFILE_ZONE("scene load");
+		if (!load_scene(scene, scene_name))
+		{
+			doutput("unknown scene %s\n", scene_name.c_str());
+			return 1;
+		}
+	}
+
+	// -heatmap name writes name.bmp and name.pfm with the cost of every pixel next to name_beauty.bmp,
+	// -cost rays counts rays instead of cycles in RAY_STATS builds
+	std::string heatmap_name = arg_str(args, "-heatmap");
+	fImage cost(screen.width, screen.height);
+
+	Render_stats stats;
+	if (!heatmap_name.empty())
+	{
+		stats.cost = &cost;
+		Cost_metric wanted = arg_str(args, "-cost") == "rays" ? COST_RAYS : COST_CYCLES;
+		stats.cost_metric = measured_cost_metric(wanted);
+		if (stats.cost_metric != wanted)
+			doutput("-cost %s needs a RAY_STATS build, the heatmap counts %s\n", cost_metric_name(wanted), cost_metric_name(stats.cost_metric));
+	}
+
+	// -exposure stops, -tonemap reinhard|aces, -srgb, -dither
+	Render_settings settings;
+	std::string exposure = arg_str(args, "-exposure");
+	std::string tone = arg_str(args, "-tonemap");
+	if (!exposure.empty()) settings.tonemap.exposure = atof(exposure.c_str());
+	if (tone == "reinhard") settings.tonemap.op = TONEMAP_REINHARD;
+	if (tone == "aces") settings.tonemap.op = TONEMAP_ACES;
+	settings.tonemap.srgb = has_arg(args, "-srgb");
+	settings.tonemap.dither = has_arg(args, "-dither");
+
+	// -spp N camera rays per pixel, -light_samples N lights sampled per hit instead of all of them,
+	// -denoise filters the noise of both with the first hit AOVs
+	settings.samples = arg_int(args, "-spp", 1);
+	settings.light_samples = arg_int(args, "-light_samples", 0);
+
+	// -sampler sobol|blue picks the random numbers of both, -seed N another noise of the same kind
+	std::string sampler = arg_str(args, "-sampler");
+	if (sampler == "sobol") settings.sampler = SAMPLER_SOBOL;
+	if (sampler == "blue") settings.sampler = SAMPLER_BLUE_NOISE;
+	settings.seed = arg_int(args, "-seed", 0);
+
+	// -no_bins tests the camera rays against every sphere instead of their tile's, the image is the same
+	settings.primary_bins = !has_arg(args, "-no_bins");
+	bool denoising = has_arg(args, "-denoise");
+
+	// -distributed N renders the tiles in N worker processes on this machine
+	int distributed = arg_int(args, "-distributed", 0);
+
+	// -progressive N sums N passes of -spp samples, -checkpoint file saves them every -interval seconds
+	// (30 by default) and at the end, -resume file continues a saved render up to -progressive passes
+	int progressive = arg_int(args, "-progressive", 0);
+	std::string checkpoint = arg_str(args, "-checkpoint");
+	std::string resume = arg_str(args, "-resume");
+	int interval = arg_int(args, "-interval", 30);
 
+	// -region x0,y0,x1,y1 traces only that rectangle, in pixels or with decimal points in 0..1 of the frame,
+	// -save_crop file writes just the rectangle, -merge a,b,... assembles such files into the frame and
+	// -out file.pfm saves the merged frame
+	std::string region = arg_str(args, "-region");
+	std::string crop_file = arg_str(args, "-save_crop");
+	std::string merge_list = arg_str(args, "-merge");
+	std::string merged_file = arg_str(args, "-out");
+
+	// -image file.bmp writes the rendered frame
+	std::string image_file = arg_str(args, "-image");
+	if (!region.empty())
+	{
+		if (!parse_crop(region, screen.width, screen.height, settings.crop))
+		{
+			doutput("bad region %s\n", region.c_str());
+			return 1;
+		}
+		// the rest of the frame stays black
+		std::fill(hdr.data, hdr.data + hdr.width * hdr.height, fColor(0.0f, 0.0f, 0.0f));
+		tonemap(hdr, screen, settings.tonemap);
+	}
+
+	// -relight degrees traces the camera paths once, then turns the lights around the scene one degree
+	// per frame and only reshades the paths for each; the frame times are printed and the last one is shown
+	int relight_degrees = arg_int(args, "-relight", 0);
+	if (relight_degrees > 0 && !settings.crop.empty())
+	{
+		doutput("-region doesn't work with -relight\n");
+		return 1;
+	}
+
+	// -aov depth,normal,albedo,material,object picks the AOVs, -exr name.exr writes them with the beauty
+	std::string aov_names = arg_str(args, "-aov");
+	std::string aov_file = arg_str(args, "-exr");
+	int aov_flags = denoising ? DENOISE_AOVS : 0;
+	for (const std::string& name : split_list(aov_names))
+	{
+		if (name == "depth") aov_flags |= AOV_DEPTH;
+		else if (name == "normal") aov_flags |= AOV_NORMAL;
+		else if (name == "albedo") aov_flags |= AOV_ALBEDO;
+		else if (name == "material") aov_flags |= AOV_MATERIAL_ID;
+		else if (name == "object") aov_flags |= AOV_OBJECT_ID;
+		else doutput("unknown aov %s\n", name.c_str());
+	}
+	if (!aov_file.empty() && aov_names.empty()) aov_flags |= AOV_DEPTH | AOV_NORMAL | AOV_ALBEDO | AOV_MATERIAL_ID | AOV_OBJECT_ID;
+
+	Aov_buffers aovs;
+	aovs.resize(screen.width, screen.height, aov_flags);
+
+	// only the single frame render() measures the cost of its pixels, the other paths would write an empty heatmap
+	bool measured = denoising || !aov_file.empty() ||
+		(merge_list.empty() && relight_degrees <= 0 && progressive <= 0 && resume.empty() && distributed <= 0);
+	if (!heatmap_name.empty() && !measured)
+	{
+		doutput("-heatmap doesn't work with -merge, -relight, -progressive, -resume or -distributed\n");
+		return 1;
+	}
+
+	// -script file runs the interactive loop on the scripted input without a window and prints the frame times,
+	// it works in the headless build too
+	std::string script_name = arg_str(args, "-script");
+	bool interactive = has_arg(args, "-interactive");
+	if (!script_name.empty())
+	{
+		Input_script script;
+		if (!script.load(script_name.c_str()))
+		{
+			doutput("can't read %s\n", script_name.c_str());
+			return 1;
+		}
+		Frame_loop loop(scene, settings, screen.width, screen.height);
+		print_frame_times(run_script(loop, script, screen));
+		up_side_dawn(screen);
+		if (!image_file.empty() && !write_bmp(image_file.c_str(), screen))
+			doutput("can't write %s\n", image_file.c_str());
+		write_trace(args);
+		return 0;
+	}
+
+#ifdef _WIN32
 	Window window(L"ray tracer", 800, 600, DEF_STYLE, NULL, &screen, [](HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)->LRESULT
 	{
 		Window* window = (Window*)arguments.get(hwnd)[0];
 		if (!window) return DefWindowProc(hwnd, msg, wParam, lParam);
 
 		Image* buffer = (Image*)arguments.get(hwnd)[1];
+		process_input(keys, mouse, msg, wParam, lParam);
 
 		switch (msg)
 		{
@@ -40,12 +292,16 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE lool, LPSTR cmdLine, int show)
 				BeginPaint(hwnd, &plug);
 				
 				draw_image(window->canvas, *buffer, 0.0f, 0.0f, 1.0f, 1.0f);
-				window->render_canvas();
+				{
+					PROFILE_ZONE("present");
+					window->render_canvas();
+				}
 
 				EndPaint(hwnd, &plug);
 			}break;
 			case WM_CLOSE:
 			{
+				running = false;
 				PostQuitMessage(0);
 			}break;
 		}
@@ -53,29 +309,174 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE lool, LPSTR cmdLine, int show)
 
 		return DefWindowProc(hwnd, msg, wParam, lParam);
 	});
+#endif
 
+	// -interactive renders continuously, arrows or WASD move the camera and a left button drag looks around
+	if (interactive)
+	{
+#ifdef _WIN32
+		Frame_loop loop(scene, settings, screen.width, screen.height);
+		Timer timer;
+		while (running)
+		{
+			Window::default_msg_proc();
+			timer.update();
+			loop.frame(keys, mouse, timer.elapsed, screen);
+			end_input_frame(keys, mouse);
 
+			up_side_dawn(screen);
+			draw_image(window.canvas, screen, 0.0f, 0.0f, 1.0f, 1.0f);
+			window.render_canvas();
+		}
+		write_trace(args);
+		return 0;
+#else
+		doutput("-interactive needs a window, -script runs the loop on recorded input\n");
+		return 1;
+#endif
+	}
 
-	// ray tracer
-	Material      ivory(1.0, vec4f(0.6, 0.3, 0.1, 0.0), vec3f(0.4, 0.4, 0.3), 50.);
-	Material      glass(1.5, vec4f(0.0, 0.5, 0.1, 0.8), vec3f(0.6, 0.7, 0.8), 125.);
-	Material red_rubber(1.0, vec4f(0.9, 0.1, 0.0, 0.0), vec3f(0.3, 0.1, 0.1), 10.);
-	Material     mirror(1.0, vec4f(0.0, 10.0, 0.8, 0.0), vec3f(1.0, 1.0, 1.0), 1425.);
-
-	std::vector<Sphere> spheres;
-	spheres.push_back(Sphere(vec3f(-3, 0, -16), 2, ivory));
-	spheres.push_back(Sphere(vec3f(-1.0, -1.5, -12), 2, glass));
-	spheres.push_back(Sphere(vec3f(1.5, -0.5, -18), 3, red_rubber));
-	spheres.push_back(Sphere(vec3f(7, 5, -18), 4, mirror));
-
-	std::vector<Light>  lights;
-	lights.push_back(Light(vec3f(-20, 20, 20), 1.5));
-	lights.push_back(Light(vec3f(30, 50, -25), 1.8));
-	lights.push_back(Light(vec3f(30, 20, 30), 1.7));
-
-	render(screen, spheres, lights);
+	if (denoising || !aov_file.empty())
+	{
+		render(hdr, scene, settings, &stats, &aovs);
+		if (!aov_file.empty() && !aovs.write_exr(aov_file.c_str(), &hdr))
+			doutput("can't write %s\n", aov_file.c_str());
+		if (denoising)
+		{
+			Denoise_buffers denoise_buffers;
+			Denoise_settings denoise_settings;
+			denoise_settings.samples = settings.samples;
+			denoise(hdr, aovs, denoise_buffers, denoise_settings);
+		}
+		tonemap(hdr, screen, settings.tonemap);
+	}
+	else if (!merge_list.empty())
+	{
+		std::vector<std::string> paths = split_list(merge_list);
+		fImage merged;
+		int missing = merge_crops(paths, merged);
+		if (missing < 0 || merged.width != hdr.width || merged.height != hdr.height)
+		{
+			doutput("can't merge %s\n", merge_list.c_str());
+			return 1;
+		}
+		if (missing) doutput("%d pixels not in any crop\n", missing);
+		tonemap(merged, screen, settings.tonemap);
+		if (!merged_file.empty())
+		{
+			up_side_dawn(merged);
+			if (!write_pfm(merged_file.c_str(), merged)) doutput("can't write %s\n", merged_file.c_str());
+		}
+	}
+	else if (!crop_file.empty() && !settings.crop.empty())
+	{
+		fImage crop(settings.crop.width(), settings.crop.height());
+		render(crop, scene, settings);
+		if (!write_crop(crop_file, crop, settings.crop)) doutput("can't write %s\n", crop_file.c_str());
+		for (int y = 0; y < crop.height; y++)
+			memcpy(&hdr.data[settings.crop.x0 + (settings.crop.y0 + y) * hdr.width], &crop.data[y * crop.width], crop.width * sizeof(fColor));
+		tonemap(hdr, screen, settings.tonemap, settings.crop.x0, settings.crop.y0, settings.crop.x1, settings.crop.y1);
+	}
+	else if (relight_degrees > 0)
+	{
+		Relight_cache cache;
+		capture_paths(cache, hdr.width, hdr.height, scene, settings);
+
+		// the lights turn around the middle of the spheres, or around the origin without any
+		vec3f center;
+		for (const Sphere& sphere : scene.spheres) center = center + sphere.center;
+		if (!scene.spheres.empty()) center = center * (1.0f / scene.spheres.size());
+
+		std::vector<double> times;
+		for (int frame = 0; frame < relight_degrees; frame++)
+		{
+			auto start = high_resolution_clock::now();
+			orbit_lights(scene, center, PI / 180.0f);
+			relight(hdr, cache, scene, settings);
+			times.push_back(duration<double>(high_resolution_clock::now() - start).count());
+		}
+		print_frame_times(times);
+		tonemap(hdr, screen, settings.tonemap);
+	}
+	else if (progressive > 0 || !resume.empty())
+	{
+		Progressive_render progress;
+		if (resume.empty())
+			progress.start(hdr.width, hdr.height, settings);
+		else
+		{
+			std::string saved_scene;
+			if (!read_checkpoint(resume, progress, saved_scene) || progress.width != hdr.width || progress.height != hdr.height ||
+				(saved_scene != scene_name && !load_scene(scene, saved_scene)))
+			{
+				doutput("can't resume from %s\n", resume.c_str());
+				return 1;
+			}
+			scene_name = saved_scene;
+			doutput("resuming at pass %u\n", progress.passes);
+		}
+
+		Checkpoint_writer writer(checkpoint, scene_name.empty() ? "default" : scene_name);
+		auto last_checkpoint = high_resolution_clock::now();
+		while (progress.passes < (uint32_t)progressive)
+		{
+			progress.render_pass(scene);
+			if (!checkpoint.empty() && high_resolution_clock::now() - last_checkpoint >= seconds(interval) && writer.save(progress))
+				last_checkpoint = high_resolution_clock::now();
+		}
+		if (!checkpoint.empty())
+		{
+			// the final save doesn't depend on the periodic ones, a failed one is only reported
+			writer.wait();
+			if (writer.failed) doutput("a periodic checkpoint to %s failed\n", checkpoint.c_str());
+			if (!write_checkpoint(checkpoint, progress, writer.scene))
+				doutput("can't write %s\n", checkpoint.c_str());
+		}
+		progress.resolve(hdr);
+		tonemap(hdr, screen, progress.settings.tonemap);
+	}
+	else if (distributed > 0)
+	{
+		Render_farm farm;
+		Distributed_settings farm_settings;
+		farm_settings.workers = distributed;
+		if (!scene_name.empty()) farm_settings.scene = scene_name;
+		if (farm.start(farm_settings))
+			farm.render(screen, hdr, scene, settings);
+		else
+			render(screen, hdr, scene, settings);
+		doutput("%d tiles, %d by %d workers, %d local, %d retried, %d restarts\n", farm.stats.tiles, farm.stats.remote_tiles,
+				distributed, farm.stats.local_tiles, farm.stats.retried_tiles, farm.stats.restarts);
+	}
+	else
+	{
+		render(screen, hdr, scene, settings, &stats);
+	}
 	up_side_dawn(screen);
+#ifdef RAY_STATS
+	stats.total.print("render");
+#endif
+
+	if (!heatmap_name.empty())
+	{
+		up_side_dawn(cost);
+		Image heat;
+		float top = heatmap(cost, heat);
+		doutput("heatmap white at %.0f %s\n", top, cost_metric_name(stats.cost_metric));
+
+		if (!write_bmp((heatmap_name + ".bmp").c_str(), heat) || !write_pfm((heatmap_name + ".pfm").c_str(), cost, 1) ||
+			!write_bmp((heatmap_name + "_beauty.bmp").c_str(), screen))
+			doutput("can't write %s\n", heatmap_name.c_str());
+	}
+
+	if (!image_file.empty() && !write_bmp(image_file.c_str(), screen))
+		doutput("can't write %s\n", image_file.c_str());
 
+#ifdef _WIN32
 	Window::wait_msg_proc();
+#else
+	if (image_file.empty()) doutput("no window in this build, -image file.bmp saves the frame\n");
+#endif
+	write_trace(args);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+// Localhost sockets and child processes for the distributed renderer. Winsock and CreateProcess on
+// Windows, the POSIX calls elsewhere, so a coordinator and its workers also run on one Linux box.
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+typedef int socklen_t;
+#define BAD_SOCKET INVALID_SOCKET
+#define SEND_FLAGS 0
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int socket_t;
+#define BAD_SOCKET (-1)
+#define SEND_FLAGS MSG_NOSIGNAL   // a dead worker is an error to handle, not a SIGPIPE
+#endif
+
+
+bool net_init()
+{
+#ifdef _WIN32
+    static bool started = false;
+    if (started) return true;
+    WSADATA data;
+    started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    return started;
+#else
+    return true;
+#endif
+}
+
+void close_socket(socket_t s)
+{
+    if (s == BAD_SOCKET) return;
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+// workers are started while sockets are open, they mustn't keep the coordinator's connections alive
+inline void no_inherit(socket_t s)
+{
+#ifndef _WIN32
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+// the messages are small and answered right away, Nagle would only add latency
+inline void set_no_delay(socket_t s)
+{
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+}
+
+// listens on 127.0.0.1, port 0 picks a free one and port gets the one that was bound
+socket_t listen_local(int& port)
+{
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == BAD_SOCKET) return BAD_SOCKET;
+    no_inherit(s);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    socklen_t size = sizeof(address);
+    if (bind(s, (sockaddr*)&address, sizeof(address)) != 0 || listen(s, 64) != 0 || getsockname(s, (sockaddr*)&address, &size) != 0)
+    {
+        close_socket(s);
+        return BAD_SOCKET;
+    }
+    port = ntohs(address.sin_port);
+    return s;
+}
+
+socket_t connect_local(int port)
+{
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == BAD_SOCKET) return BAD_SOCKET;
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    if (connect(s, (sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close_socket(s);
+        return BAD_SOCKET;
+    }
+    set_no_delay(s);
+    return s;
+}
+
+socket_t accept_socket(socket_t listener)
+{
+    socket_t s = accept(listener, NULL, NULL);
+    if (s == BAD_SOCKET) return BAD_SOCKET;
+    no_inherit(s);
+    set_no_delay(s);
+    return s;
+}
+
+bool send_all(socket_t s, const void* data, size_t size)
+{
+    const char* p = (const char*)data;
+    while (size > 0)
+    {
+        int sent = send(s, p, (int)(std::min)(size, (size_t)1 << 30), SEND_FLAGS);
+        if (sent <= 0) return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// false if the other side closed or failed before size bytes came
+bool recv_all(socket_t s, void* data, size_t size)
+{
+    char* p = (char*)data;
+    while (size > 0)
+    {
+        int got = recv(s, p, (int)(std::min)(size, (size_t)1 << 30), 0);
+        if (got <= 0) return false;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+// waits up to timeout_ms for any of sockets to have data (or a closed connection), ready gets
+// which ones, returns false on timeout
+bool wait_readable(const std::vector<socket_t>& sockets, int timeout_ms, std::vector<bool>& ready)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    socket_t top = 0;
+    for (socket_t s : sockets)
+    {
+        FD_SET(s, &set);
+        top = (std::max)(top, s);
+    }
+    timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int count = select((int)top + 1, &set, NULL, NULL, &timeout);
+
+    ready.assign(sockets.size(), false);
+    for (size_t i = 0; i < sockets.size() && count > 0; i++)
+        ready[i] = FD_ISSET(sockets[i], &set) != 0;
+    return count > 0;
+}
+
+
+// another instance of this executable
+struct Child_process
+{
+#ifdef _WIN32
+    HANDLE process = NULL;
+#else
+    pid_t pid = -1;
+#endif
+
+    // args as they'd follow the program name on a command line, split at spaces
+    bool start(const std::string& args)
+    {
+#ifdef _WIN32
+        char path[MAX_PATH];
+        if (!GetModuleFileNameA(NULL, path, MAX_PATH)) return false;
+        std::string command = "\"" + std::string(path) + "\" " + args;
+
+        STARTUPINFOA startup = {};
+        startup.cb = sizeof(startup);
+        PROCESS_INFORMATION info = {};
+        if (!CreateProcessA(path, &command[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup, &info)) return false;
+        CloseHandle(info.hThread);
+        process = info.hProcess;
+        return true;
+#else
+        // everything the child needs is prepared before the fork
+        std::vector<std::string> words;
+        for (size_t begin = 0; begin < args.size();)
+        {
+            size_t end = args.find(' ', begin);
+            if (end == std::string::npos) end = args.size();
+            if (end > begin) words.push_back(args.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        std::vector<char*> argv;
+        static char name[] = "ray_tracer_worker";
+        argv.push_back(name);
+        for (std::string& word : words) argv.push_back(&word[0]);
+        argv.push_back(NULL);
+
+        pid = fork();
+        if (pid == 0)
+        {
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+        return pid > 0;
+#endif
+    }
+
+    bool running()
+    {
+#ifdef _WIN32
+        return process && WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+#else
+        if (pid <= 0) return false;
+        if (waitpid(pid, NULL, WNOHANG) == 0) return true;
+        pid = -1;
+        return false;
+#endif
+    }
+
+    // waits up to timeout_ms for it to exit on its own, then kills it
+    void stop(int timeout_ms = 0)
+    {
+#ifdef _WIN32
+        if (!process) return;
+        if (WaitForSingleObject(process, timeout_ms) != WAIT_OBJECT_0) TerminateProcess(process, 1);
+        WaitForSingleObject(process, INFINITE);
+        CloseHandle(process);
+        process = NULL;
+#else
+        if (pid <= 0) return;
+        for (int waited = 0; waited < timeout_ms && running(); waited += 5)
+            usleep(5000);
+        if (pid > 0)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        pid = -1;
+#endif
+    }
+
+    int id() const
+    {
+#ifdef _WIN32
+        return process ? (int)GetProcessId(process) : 0;
+#else
+        return pid;
+#endif
+    }
+};
+
+int current_process_id()
+{
+#ifdef _WIN32
+    return (int)GetCurrentProcessId();
+#else
+    return (int)getpid();
+#endif
+}
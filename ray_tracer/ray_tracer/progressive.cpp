@@ -0,0 +1,219 @@
+// Progressive rendering with checkpoints. Passes of settings.samples jittered rays per pixel are
+// summed until the render is stopped; a checkpoint on disk holds the sums, the samples per pixel
+// and everything the next pass depends on, so a preempted render continues instead of starting
+// over. The random numbers are keyed by the seed and the sample index, which every pass continues,
+// so they are part of the saved state too: a resumed render is the same as an uninterrupted one.
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct Progressive_render
+{
+    int width = 0, height = 0;
+    Render_settings settings;         // samples is per pass
+    uint32_t passes = 0;              // done so far
+    fImage sum;                       // linear colors summed over the samples
+    std::vector<uint32_t> counts;     // samples per pixel
+    fImage pass;                      // colors of the pass being rendered
+
+    void start(int width, int height, const Render_settings& settings)
+    {
+        this->width = width;
+        this->height = height;
+        this->settings = settings;
+        passes = 0;
+        sum.resize(width, height);
+        pass.resize(width, height);
+        std::fill(sum.data, sum.data + (size_t)width * height, fColor(0.0f, 0.0f, 0.0f, 0.0f));
+        counts.assign((size_t)width * height, 0);
+    }
+
+    void render_pass(const Scene& scene)
+    {
+        PROFILE_ZONE("progressive pass");
+        Render_settings pass_settings = settings;
+        pass_settings.jitter = true;
+        const uint32_t samples = max(settings.samples, 1);
+        pass_settings.first_sample = settings.first_sample + passes * samples;
+        Cast_ray_kernel kernel = select_kernel(scene, pass_settings);
+        // with settings.crop only its pixels get samples, the others resolve to black
+        const Crop_window window = render_window(pass, pass_settings);
+        Tile_bins bins;
+        const Tile_bins* primary = bin_spheres(bins, scene, pass_settings, window);
+
+        // each tile is added to the sums right after it's rendered, while it is still in the cache
+        workers.parallel_for_2d(window.x0, window.y0, window.x1, window.y1, settings.tile_size, settings.tile_size, [&](int x0, int y0, int x1, int y1)
+        {
+            render_tile(pass, scene, pass_settings, kernel, x0, y0, x1, y1, NULL, NULL, primary);
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++)
+                {
+                    const int idx = x + y * width;
+                    const fColor& c = pass.data[idx];
+                    fColor& s = sum.data[idx];
+                    s.r += c.r * samples;
+                    s.g += c.g * samples;
+                    s.b += c.b * samples;
+                    counts[idx] += samples;
+                }
+        });
+        passes++;
+    }
+
+    // the average so far, rows top first
+    void resolve(fImage& hdr) const
+    {
+        assert(hdr.width == width && hdr.height == height);
+        workers.parallel_for(0, height, 8, [&](size_t from_y, size_t to_y)
+        {
+            for (size_t idx = from_y * width; idx < to_y * width; idx++)
+            {
+                const float inv = counts[idx] ? 1.0f / counts[idx] : 0.0f;
+                const fColor& s = sum.data[idx];
+                hdr.data[idx] = fColor(s.r * inv, s.g * inv, s.b * inv);
+            }
+        });
+    }
+
+    // into other, which keeps its buffers when the size stays
+    void copy_to(Progressive_render& other) const
+    {
+        if (other.width != width || other.height != height || !other.sum.data) other.sum.resize(width, height);
+        other.width = width;
+        other.height = height;
+        other.settings = settings;
+        other.passes = passes;
+        memcpy(other.sum.data, sum.data, sizeof(fColor) * width * height);
+        other.counts = counts;
+    }
+};
+
+
+// ===================== checkpoint files =====================
+
+// the header, then the samples per pixel and the sums, rows top first
+struct Checkpoint_header
+{
+    char magic[8];              // "RTCKPT2"
+    uint32_t settings_size;     // sizeof(Render_settings), another build can't read the settings
+    int32_t width, height;
+    uint32_t passes;
+    Render_settings settings;
+    char scene[64];             // load_scene() name
+};
+
+// replaces path with the finished temporary file, the old checkpoint stays until then
+inline bool replace_file(const std::string& from, const std::string& path)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from.c_str(), path.c_str()) == 0;
+#endif
+}
+
+// Writes path.tmp and renames it to path once it's on the disk, so a crash or preemption while
+// writing leaves the previous checkpoint. scene is the load_scene() name of the render's scene.
+bool write_checkpoint(const std::string& path, const Progressive_render& render, const std::string& scene)
+{
+    PROFILE_ZONE("write checkpoint");
+    Checkpoint_header header = {};
+    memcpy(header.magic, "RTCKPT2", 8);
+    header.settings_size = sizeof(Render_settings);
+    header.width = render.width;
+    header.height = render.height;
+    header.passes = render.passes;
+    header.settings = render.settings;
+    if (scene.size() >= sizeof(header.scene)) return false;
+    memcpy(header.scene, scene.c_str(), scene.size());
+
+    std::string temporary = path + ".tmp";
+    FILE* file = open_file(temporary.c_str(), "wb");
+    if (!file) return false;
+
+    const size_t pixels = (size_t)render.width * render.height;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(render.counts.data(), sizeof(uint32_t), pixels, file) == pixels &&
+              fwrite(render.sum.data, sizeof(fColor), pixels, file) == pixels &&
+              fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+    if (ok && replace_file(temporary, path)) return true;
+    remove(temporary.c_str());
+    return false;
+}
+
+// false if path isn't a complete checkpoint of this build, render is left as it was then
+bool read_checkpoint(const std::string& path, Progressive_render& render, std::string& scene)
+{
+    FILE* file = open_file(path.c_str(), "rb");
+    if (!file) return false;
+
+    Checkpoint_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "RTCKPT2", 8) == 0 &&
+              header.settings_size == sizeof(Render_settings) && header.width > 0 && header.height > 0 &&
+              memchr(header.scene, 0, sizeof(header.scene));
+    if (ok)
+    {
+        Progressive_render loaded;
+        loaded.start(header.width, header.height, header.settings);
+        loaded.passes = header.passes;
+        const size_t pixels = (size_t)header.width * header.height;
+        ok = fread(loaded.counts.data(), sizeof(uint32_t), pixels, file) == pixels &&
+             fread(loaded.sum.data, sizeof(fColor), pixels, file) == pixels && fgetc(file) == EOF;
+        if (ok)
+        {
+            loaded.copy_to(render);
+            render.pass.resize(header.width, header.height);
+            scene = header.scene;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+
+// Saves checkpoints on a thread of its own, the render goes on while a copy of the sums is written.
+struct Checkpoint_writer
+{
+    std::string path;
+    std::string scene;
+    Progressive_render snapshot;
+    std::thread thread;
+    std::atomic<bool> busy{false};
+    std::atomic<bool> failed{false};   // set when a write didn't make it
+
+    Checkpoint_writer(const std::string& path, const std::string& scene) : path(path), scene(scene) {}
+    ~Checkpoint_writer() { wait(); }
+
+    // copies the state and returns, false without saving if the last checkpoint is still being
+    // written, that one is skipped rather than the workers stalled
+    bool save(const Progressive_render& render)
+    {
+        if (busy) return false;
+        wait();
+        {
+            PROFILE_ZONE("checkpoint copy");
+            render.copy_to(snapshot);
+        }
+        busy = true;
+        thread = std::thread([this]()
+        {
+            if (!write_checkpoint(path, snapshot, scene)) failed = true;
+            busy = false;
+        });
+        return true;
+    }
+
+    void wait()
+    {
+        if (thread.joinable()) thread.join();
+    }
+};
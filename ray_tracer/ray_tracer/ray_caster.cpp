@@ -1,26 +1,42 @@
 
 #include <limits>
+#include <unordered_map>
 
 
-Color vec_color(vec3f vec)
-{
-    return Color(min(255.0f * vec.x, 255.0f), min(255.0f, 255.0f * vec.y), min(255.0f, 255.0f * vec.y));
-}
-
-struct Light
-{
-    vec3f position;
-    float intensity;
-    Light(const vec3f& p, const float& i) : position(p), intensity(i) {}
-};
-
 struct Material {
-    Material(const float& r, const vec4f& a, const vec3f& color, const float& spec) : refractive_index(r), albedo(a), diffuse_color(color), specular_exponent(spec) {}
-    Material() : refractive_index(1), albedo(1, 0, 0, 0), diffuse_color(), specular_exponent() {}
+    Material(const float& r, const vec4f& a, const vec3f& color, const float& spec) : refractive_index(r), albedo(a), diffuse_color(color), specular_exponent(spec), specular(spec) {}
+    Material() : refractive_index(1), albedo(1, 0, 0, 0), diffuse_color(), specular_exponent(), specular() {}
     float refractive_index;
     vec4f albedo;
     vec3f diffuse_color;
     float specular_exponent;
+    Specular specular;
+    int id = -1;   // set by Scene::build, equal materials get the same id
+};
+
+// the bits of the values that make a material, Scene::build gives equal keys the same id
+struct Material_key
+{
+    uint32_t bits[9];
+
+    explicit Material_key(const Material& material)
+    {
+        const float values[9] = { material.refractive_index, material.albedo.x, material.albedo.y, material.albedo.z, material.albedo.w,
+                                  material.diffuse_color.x, material.diffuse_color.y, material.diffuse_color.z, material.specular_exponent };
+        memcpy(bits, values, sizeof(bits));
+    }
+
+    bool operator ==(const Material_key& other) const { return !memcmp(bits, other.bits, sizeof(bits)); }
+
+    struct Hash
+    {
+        size_t operator ()(const Material_key& key) const
+        {
+            uint32_t h = 0;
+            for (uint32_t bits : key.bits) h = hash32(h ^ bits);
+            return h;
+        }
+    };
 };
 
 struct Sphere
@@ -29,10 +45,11 @@ struct Sphere
     float radius;
     Material material;
 
-    Sphere(vec3f center, float radius, Material material) : center(center), radius(radius), material(material) {}
+    Sphere(const vec3f& center, float radius, const Material& material) : center(center), radius(radius), material(material) {}
 
     bool ray_intersect(const vec3f& orig, const vec3f& dir, float& t0) const
     {
+        RAY_STAT(sphere_tests, 1);
         vec3f L = center - orig;
         float tca = L * dir;
         float d2 = L * L - tca * tca;
@@ -48,36 +65,422 @@ struct Sphere
 };
 
 
-bool scene_intersect(const vec3f& orig, const vec3f& dir, const std::vector<Sphere>& spheres, vec3f& hit, vec3f& N, Material& material) {
-    float spheres_dist = (std::numeric_limits<float>::max)();
+// Sphere centers and squared radii in SoA layout, padded to a multiple of 8 with spheres
+// that are never hit. Rays are tested against 4 or 8 spheres at once depending on the cpu.
+struct Sphere_soa
+{
+    std::vector<float> x, y, z, r2;
+    std::vector<int> ids;   // scene sphere of every lane, empty when lane i is sphere i
+    int count = 0;
 
-    for (size_t i = 0; i < spheres.size(); i++)
+    void build(const std::vector<Sphere>& spheres)
     {
-        float dist_i;
-        if (spheres[i].ray_intersect(orig, dir, dist_i) && dist_i < spheres_dist) {
-            spheres_dist = dist_i;
-            hit = orig + dir * dist_i;
-            N = (hit - spheres[i].center).normalize();
-            material = spheres[i].material;
+        count = (spheres.size() + 7) & ~7;
+        ids.clear();
+        x.assign(count, 0);
+        y.assign(count, 0);
+        z.assign(count, 0);
+        r2.assign(count, -1);
+        for (size_t i = 0; i < spheres.size(); i++)
+        {
+            x[i] = spheres[i].center.x;
+            y[i] = spheres[i].center.y;
+            z[i] = spheres[i].center.z;
+            r2[i] = spheres[i].radius * spheres[i].radius;
         }
     }
 
-    float checkerboard_dist = (std::numeric_limits<float>::max)();
-    if (fabs(dir.y) > 1e-3) {
-        float d = -(orig.y + 4) / dir.y; // the checkerboard plane has equation y = -4
-        vec3f pt = orig + dir * d;
-        if (d > 0 && fabs(pt.x) < 10 && pt.z<-10 && pt.z>-30 && d < spheres_dist) {
-            checkerboard_dist = d;
-            hit = pt;
-            N = vec3f(0, 1, 0);
-            material.diffuse_color = (int(.5 * hit.x + 1000) + int(.5 * hit.z)) & 1 ? vec3f(1, 1, 1) : vec3f(1, .7, .3);
-            material.diffuse_color = material.diffuse_color * .3;
+    // distance to the lanes spheres along the ray, mask of the lanes that are hit, same math as Sphere::ray_intersect
+    template <typename F>
+    static SIMD_INLINE F intersect(const vec3_wide<F>& center, const F& radius2, const vec3_wide<F>& orig, const vec3_wide<F>& dir, F& t)
+    {
+        vec3_wide<F> L = center - orig;
+        F tca = L * dir;
+        F d2 = L * L - tca * tca;
+        F thc = sqrt(radius2 - d2);
+        F t0 = tca - thc;
+        t = select(t0 < F(0.0f), tca + thc, t0);
+        return (d2 <= radius2) & (t >= F(0.0f));
+    }
+
+    // lane of the closest sphere in lanes [begin, end) closer than t, -1 if there is none
+    int closest_sse(const vec3f& orig, const vec3f& dir, float& t, int begin, int end) const
+    {
+        vec3x4 o(orig), d(dir);
+        float4 best_t(t), best_i(-1.0f);
+        float4 lane(_mm_set_ps(3, 2, 1, 0));
+
+        for (int i = begin; i < end; i += 4)
+        {
+            float4 ti;
+            float4 hit = intersect(vec3x4(float4::load(&x[i]), float4::load(&y[i]), float4::load(&z[i])), float4::load(&r2[i]), o, d, ti);
+            hit = hit & (ti < best_t);
+            best_t = select(hit, ti, best_t);
+            best_i = select(hit, lane + float4((float)i), best_i);
+        }
+        return reduce(best_t, best_i, 4, t);
+    }
+
+    // index of any sphere closer than max_dist other than lane skip, -1 if there is none
+    int any_sse(const vec3f& orig, const vec3f& dir, float max_dist, int skip) const
+    {
+        vec3x4 o(orig), d(dir);
+        for (int i = 0; i < count; i += 4)
+        {
+            float4 ti;
+            float4 hit = intersect(vec3x4(float4::load(&x[i]), float4::load(&y[i]), float4::load(&z[i])), float4::load(&r2[i]), o, d, ti);
+            int mask = (hit & (ti < float4(max_dist))).mask() & ~skip_bit(skip, i, 4);
+            if (mask) return i + lowest_bit(mask);
+        }
+        return -1;
+    }
+
+AVX_BEGIN
+    SIMD_FLATTEN int closest_avx(const vec3f& orig, const vec3f& dir, float& t, int begin, int end) const
+    {
+        vec3x8 o(orig), d(dir);
+        float8 best_t(t), best_i(-1.0f);
+        float8 lane(_mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0));
+
+        for (int i = begin; i < end; i += 8)
+        {
+            float8 ti;
+            float8 hit = intersect(vec3x8(float8::load(&x[i]), float8::load(&y[i]), float8::load(&z[i])), float8::load(&r2[i]), o, d, ti);
+            hit = hit & (ti < best_t);
+            best_t = select(hit, ti, best_t);
+            best_i = select(hit, lane + float8((float)i), best_i);
+        }
+
+        float lanes_t[8], lanes_i[8];
+        best_t.store(lanes_t);
+        best_i.store(lanes_i);
+        return reduce(lanes_t, lanes_i, 8, t);
+    }
+
+    SIMD_FLATTEN int any_avx(const vec3f& orig, const vec3f& dir, float max_dist, int skip) const
+    {
+        vec3x8 o(orig), d(dir);
+        for (int i = 0; i < count; i += 8)
+        {
+            float8 ti;
+            float8 hit = intersect(vec3x8(float8::load(&x[i]), float8::load(&y[i]), float8::load(&z[i])), float8::load(&r2[i]), o, d, ti);
+            int mask = (hit & (ti < float8(max_dist))).mask() & ~skip_bit(skip, i, 8);
+            if (mask) return i + lowest_bit(mask);
+        }
+        return -1;
+    }
+AVX_END
+
+    int closest(const vec3f& orig, const vec3f& dir, float& t) const
+    {
+        return closest(orig, dir, t, 0, count);
+    }
+
+    // begin and end are multiples of 8
+    int closest(const vec3f& orig, const vec3f& dir, float& t, int begin, int end) const
+    {
+        RAY_STAT(sphere_tests, end - begin);
+        return cpu.avx ? closest_avx(orig, dir, t, begin, end) : closest_sse(orig, dir, t, begin, end);
+    }
+
+    int sphere(int lane) const { return ids.empty() ? lane : ids[lane]; }
+
+    // skip is a lane the caller already tested, like the cached shadow occluder, -1 for none
+    int any(const vec3f& orig, const vec3f& dir, float max_dist, int skip = -1) const
+    {
+        int hit = cpu.avx ? any_avx(orig, dir, max_dist, skip) : any_sse(orig, dir, max_dist, skip);
+        RAY_STAT(sphere_tests, hit < 0 ? count : (hit & ~(cpu.avx ? 7 : 3)) + (cpu.avx ? 8 : 4));
+        return hit;
+    }
+
+private:
+
+    // the bit of lane skip in the mask of lanes [first, first + width)
+    static SIMD_INLINE int skip_bit(int skip, int first, int width)
+    {
+        return (unsigned)(skip - first) < (unsigned)width ? 1 << (skip - first) : 0;
+    }
+
+    static int lowest_bit(int mask)
+    {
+        int bit = 0;
+        while (!(mask & (1 << bit))) bit++;
+        return bit;
+    }
+
+    static int reduce(const float4& best_t, const float4& best_i, int lanes, float& t)
+    {
+        float lanes_t[4], lanes_i[4];
+        best_t.store(lanes_t);
+        best_i.store(lanes_i);
+        return reduce(lanes_t, lanes_i, lanes, t);
+    }
+
+    // closest lane, on equal distance the lower sphere index wins like in the scalar loop
+    static int reduce(const float* lanes_t, const float* lanes_i, int lanes, float& t)
+    {
+        int best = -1;
+        for (int l = 0; l < lanes; l++)
+        {
+            if (lanes_i[l] < 0) continue;
+            if (best < 0 || lanes_t[l] < t || (lanes_t[l] == t && lanes_i[l] < best))
+            {
+                t = lanes_t[l];
+                best = (int)lanes_i[l];
+            }
         }
+        return best;
+    }
+};
+
+// the lanes of a Sphere_soa a ray is tested against instead of all spheres of the scene
+struct Sphere_range
+{
+    const Sphere_soa* soa;
+    int begin, end;
+};
+
+
+// scene features the render kernels are specialized on
+enum Kernel_features
+{
+    KERNEL_REFLECTION = 1,
+    KERNEL_REFRACTION = 2,
+    KERNEL_PLANE      = 4,
+    KERNEL_LIGHT_TREE = 8,   // walk the light tree instead of a flat loop over the lights
+
+    KERNEL_FEATURES_COUNT = 16
+};
+
+#define MAX_DEPTH 4
+#define FLAT_LIGHTS_MAX 16
+
+
+struct Scene
+{
+    std::vector<Sphere> spheres;
+    std::vector<Light> lights;
+    bool checkerboard = true;
+
+    Light_tree light_tree;
+    Sphere_soa sphere_soa;
+    int features = 0;
+    int plane_material_id = 0;   // the checkerboard's, after the sphere materials
+
+    // must be called after the scene is filled and before rendering
+    void build()
+    {
+        PROFILE_ZONE("acceleration build");
+        sphere_soa.build(spheres);
+
+        // materials are copied into the spheres, the same values make the same material
+        std::unordered_map<Material_key, int, Material_key::Hash> material_ids;
+        material_ids.reserve(spheres.size());
+        for (Sphere& sphere : spheres)
+            sphere.material.id = material_ids.emplace(Material_key(sphere.material), (int)material_ids.size()).first->second;
+        plane_material_id = (int)material_ids.size();
+
+        features = checkerboard ? KERNEL_PLANE : 0;
+        for (const Sphere& sphere : spheres)
+        {
+            if (sphere.material.albedo.raw[2] != 0) features |= KERNEL_REFLECTION;
+            if (sphere.material.albedo.raw[3] != 0) features |= KERNEL_REFRACTION;
+        }
+        build_lights();
+    }
+
+    // enough after changing only the lights, e.g. before relight()
+    void build_lights()
+    {
+        light_tree.build(lights);
+        features &= ~KERNEL_LIGHT_TREE;
+        if (lights.size() > FLAT_LIGHTS_MAX) features |= KERNEL_LIGHT_TREE;
+    }
+};
+
+
+// Where the camera rays start and which way they go, by default from the origin down -z.
+struct Camera
+{
+    vec3f position;
+    float yaw = 0;     // radians around y, positive turns left
+    float pitch = 0;   // radians, positive looks up
+    vec3f right = vec3f(1, 0, 0), up = vec3f(0, 1, 0), forward = vec3f(0, 0, -1);   // set by turn()
+
+    void turn(float yaw, float pitch) {
+        this->yaw = yaw;
+        this->pitch = pitch;
+        right = vec3f(cosf(yaw), 0, -sinf(yaw));
+        up = vec3f(sinf(yaw) * sinf(pitch), cosf(pitch), cosf(yaw) * sinf(pitch));
+        forward = vec3f(-sinf(yaw) * cosf(pitch), sinf(pitch), -cosf(yaw) * cosf(pitch));
+    }
+
+    // from camera space, -z forward, to the world, the default camera leaves dir as it is
+    vec3f to_world(const vec3f& dir) const {
+        if (yaw == 0 && pitch == 0) return dir;
+        return right * dir.x + up * dir.y - forward * dir.z;
+    }
+
+    bool operator == (const Camera& other) const {
+        return position.x == other.position.x && position.y == other.position.y && position.z == other.position.z && yaw == other.yaw && pitch == other.pitch;
+    }
+    bool operator != (const Camera& other) const { return !(*this == other); }
+};
+
+
+// A rectangle of a frame_width x frame_height frame, render() traces only its pixels. The buffer
+// rendered into is either the whole frame, where the rest stays as it was, or just the crop.
+struct Crop_window
+{
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;   // pixels, rows top first, x1 and y1 excluded
+    int frame_width = 0, frame_height = 0;
+
+    static Crop_window pixels(int x0, int y0, int x1, int y1, int frame_width, int frame_height) {
+        Crop_window crop;
+        crop.x0 = max(x0, 0);
+        crop.y0 = max(y0, 0);
+        crop.x1 = min(x1, frame_width);
+        crop.y1 = min(y1, frame_height);
+        crop.frame_width = frame_width;
+        crop.frame_height = frame_height;
+        return crop;
+    }
+
+    // in 0..1 of the frame, rounded to the nearest pixel edges so crops sharing an edge neither
+    // overlap nor leave a gap
+    static Crop_window normalized(float u0, float v0, float u1, float v1, int frame_width, int frame_height) {
+        return pixels((int)floorf(u0 * frame_width + 0.5f), (int)floorf(v0 * frame_height + 0.5f),
+                      (int)floorf(u1 * frame_width + 0.5f), (int)floorf(v1 * frame_height + 0.5f), frame_width, frame_height);
+    }
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+
+    // the frame the camera rays are spread over and where the buffer's first pixel is in it, for a
+    // buffer of the whole frame or of the crop; without a crop the buffer is the frame
+    void place(int buffer_width, int buffer_height, int& width, int& height, int& origin_x, int& origin_y) const {
+        bool compact = !empty() && (buffer_width != frame_width || buffer_height != frame_height);
+        assert(!compact || (buffer_width == this->width() && buffer_height == this->height()));
+        width = empty() ? buffer_width : frame_width;
+        height = empty() ? buffer_height : frame_height;
+        origin_x = compact ? x0 : 0;
+        origin_y = compact ? y0 : 0;
+    }
+};
+
+
+struct Render_settings
+{
+    float light_cutoff = 0.0f;  // lights whose bounded contribution is below it are skipped
+    int light_samples = 0;      // if > 0, shade that many lights picked by importance instead of all of them
+    bool shadow_cache = true;   // test the last occluder of each light first
+    int max_depth = MAX_DEPTH;  // reflection and refraction bounces, up to MAX_DEPTH
+    int tile_size = 16;         // pixels are rendered in tile_size x tile_size tiles spread over the workers
+    Tonemap_settings tonemap;   // how the linear result is turned into 8 bit pixels
+    int samples = 1;            // camera rays per pixel, more than one are jittered over the pixel
+    bool jitter = false;        // jitter a single sample too, frames accumulated over time need it
+    int sampler = SAMPLER_RANDOM;   // where the random numbers of the jitter and the light sampling come from
+    uint32_t seed = 0;              // key of all of them, another seed gives another noise
+    uint32_t first_sample = 0;      // sample index of the first ray per pixel, passes and frames continue the sequence
+    Crop_window crop;               // if not empty, render() traces only these pixels
+    bool primary_bins = true;       // camera rays only test the spheres binned to their tile, see Tile_bins
+    Camera camera;
+};
+
+
+bool checkerboard_intersect(const vec3f& orig, const vec3f& dir, float& d, vec3f& pt) {
+    RAY_STAT(plane_tests, 1);
+    if (fabs(dir.y) <= 1e-3) return false;
+    d = -(orig.y + 4) / dir.y; // the checkerboard plane has equation y = -4
+    pt = orig + dir * d;
+    return d > 0 && fabs(pt.x) < 10 && pt.z<-10 && pt.z>-30;
+}
+
+// object, if given, gets the index of the hit sphere or the sphere count for the checkerboard.
+// candidates, if given, are the only spheres the ray can hit, e.g. the bin of a camera ray's tile.
+template <bool Plane>
+bool scene_intersect(const vec3f& orig, const vec3f& dir, const Scene& scene, vec3f& hit, vec3f& N, Material& material, int* object = NULL,
+                     const Sphere_range* candidates = NULL) {
+    RAY_STAT(intersections, 1);
+    float spheres_dist = (std::numeric_limits<float>::max)();
+
+    int closest;
+    if (candidates) {
+        closest = candidates->soa->closest(orig, dir, spheres_dist, candidates->begin, candidates->end);
+        if (closest >= 0) closest = candidates->soa->sphere(closest);
+    }
+    else
+        closest = scene.sphere_soa.closest(orig, dir, spheres_dist);
+    if (closest >= 0) {
+        const Sphere& sphere = scene.spheres[closest];
+        hit = orig + dir * spheres_dist;
+        N = (hit - sphere.center).normalize();
+        material = sphere.material;
+        if (object) *object = closest;
+    }
+
+    float checkerboard_dist = (std::numeric_limits<float>::max)();
+    float d;
+    vec3f pt;
+    if (Plane && checkerboard_intersect(orig, dir, d, pt) && d < spheres_dist) {
+        checkerboard_dist = d;
+        hit = pt;
+        N = vec3f(0, 1, 0);
+        material.diffuse_color = (int(.5 * hit.x + 1000) + int(.5 * hit.z)) & 1 ? vec3f(1, 1, 1) : vec3f(1, .7, .3);
+        material.diffuse_color = material.diffuse_color * .3;
+        material.id = scene.plane_material_id;
+        if (object) *object = scene.spheres.size();
     }
     return min(spheres_dist, checkerboard_dist) < 1000;
 }
 
-vec3f reflect(vec3f I, vec3f& N) {
+bool scene_intersect(const vec3f& orig, const vec3f& dir, const Scene& scene, vec3f& hit, vec3f& N, Material& material) {
+    return scene.checkerboard ? scene_intersect<true>(orig, dir, scene, hit, N, material) : scene_intersect<false>(orig, dir, scene, hit, N, material);
+}
+
+
+// Last blocking sphere for every light, per thread. Neighbouring pixels are mostly
+// shadowed by the same sphere, so it is tested before the full loop.
+struct Shadow_cache
+{
+    std::vector<int> occluder;
+
+    int& operator [] (int light)
+    {
+        if (light >= (int)occluder.size()) occluder.resize(light + 1, -1);
+        return occluder[light];
+    }
+};
+
+thread_local Shadow_cache shadow_cache;
+
+
+// any hit query, true if something blocks the segment [orig, orig + dir * max_dist)
+template <bool Plane>
+bool shadow_intersect(const vec3f& orig, const vec3f& dir, float max_dist, const Scene& scene, int* last_occluder) {
+    const std::vector<Sphere>& spheres = scene.spheres;
+    float dist;
+    max_dist = min(max_dist, 1000.f);
+    RAY_STAT(shadow, 1);
+
+    int cached = last_occluder ? *last_occluder : -1;
+    if (cached >= 0 && cached < (int)spheres.size() && spheres[cached].ray_intersect(orig, dir, dist) && dist < max_dist) {
+        RAY_STAT(shadow_cache_hits, 1);
+        return true;
+    }
+
+    vec3f pt;
+    if (Plane && checkerboard_intersect(orig, dir, dist, pt) && dist < max_dist)
+        return true;
+
+    // the cached sphere missed, the lanes of scene.sphere_soa are the scene's spheres
+    int occluder = scene.sphere_soa.any(orig, dir, max_dist, cached);
+    if (occluder >= 0 && last_occluder) *last_occluder = occluder;
+    return occluder >= 0;
+}
+
+vec3f reflect(const vec3f& I, const vec3f& N) {
     return I - N * 2.f * (I * N);
 }
 
@@ -95,51 +498,496 @@ vec3f refract(const vec3f& I, const vec3f& N, const float& refractive_index) { /
     return k < 0 ? vec3f(0, 0, 0) : I * eta + n * (eta * cosi - sqrtf(k));
 }
 
-vec3f cast_ray(const vec3f& orig, const vec3f& dir, std::vector<Sphere>& spheres, const std::vector<Light>& lights, size_t depth = 0) {
+// Light reaching the camera from point directly, diffuse and specular over the lights the settings
+// pick, without the reflection and refraction bounces. dir is the direction the point was seen from.
+template <int Features>
+vec3f direct_light(const vec3f& point, const vec3f& N, const vec3f& dir, const Material& material, const Scene& scene, const Render_settings& settings) {
+    constexpr bool plane = (Features & KERNEL_PLANE) != 0;
+
+    // specular terms are collected and raised to the exponent in batches
+    float diffuse_light_intensity = 0, specular_light_intensity = 0;
+    float spec_cos[64], spec_weight[64];
+    int spec_count = 0;
+
+    auto shade_light = [&](int light_idx, float weight) {
+        const Light& light = scene.light_tree.lights[light_idx];
+        RAY_STAT(lights_shaded, 1);
+        vec3f light_dir = (light.position - point).normalize();
+        float light_distance = (light.position - point).norm();
+
+        vec3f shadow_orig = light_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3; // checking if the point lies in the shadow of the light
+        int* last_occluder = settings.shadow_cache ? &shadow_cache[light_idx] : NULL;
+        if (shadow_intersect<plane>(shadow_orig, light_dir, light_distance, scene, last_occluder))
+            return;
+
+        diffuse_light_intensity += weight * light.intensity * max(0.f, light_dir * N);
+        spec_cos[spec_count] = max(0.f, -reflect(-light_dir, N) * dir);
+        spec_weight[spec_count] = weight * light.intensity;
+        if (++spec_count == 64) {
+            specular_light_intensity += material.specular.sum(spec_cos, spec_weight, spec_count);
+            spec_count = 0;
+        }
+    };
+
+    if constexpr ((Features & KERNEL_LIGHT_TREE) == 0)
+    {
+        // same culling as the light tree leaves, lights behind the surface are skipped
+        for (int i = 0; i < (int)scene.light_tree.lights.size(); i++)
+            if ((scene.light_tree.lights[i].position - point) * N > 0) shade_light(i, 1.0f);
+    }
+    else if (settings.light_samples > 0)
+    {
+        for (int i = 0; i < settings.light_samples; i++)
+        {
+            float pdf;
+            int light = scene.light_tree.sample(point, N, random_float(), pdf);
+            if (light >= 0) shade_light(light, 1.0f / (pdf * settings.light_samples));
+        }
+    }
+    else
+    {
+        scene.light_tree.for_each(point, N, settings.light_cutoff, [&](int light) { shade_light(light, 1.0f); });
+    }
+    specular_light_intensity += material.specular.sum(spec_cos, spec_weight, spec_count);
+
+    return material.diffuse_color * diffuse_light_intensity * material.albedo.raw[0] + vec3f(1., 1., 1.) * specular_light_intensity * material.albedo.raw[1];
+}
+
+typedef vec3f (*Cast_ray_kernel)(const vec3f& orig, const vec3f& dir, const Scene& scene, const Render_settings& settings, Primary_hit* first_hit,
+                                 const Sphere_range* candidates);
+
+#define BACKGROUND vec3f(0.2, 0.7, 0.8)   // what the rays that hit nothing see
+
+// cast_ray specialized on the Kernel_features of the scene, paths the scene doesn't use are compiled out.
+// Bounces is the number of reflection/refraction bounces left, the recursion ends at -1.
+// first_hit, if given, gets what the ray hit, the bounces pass NULL. candidates, if given, are the
+// spheres the ray is tested against, the bounces test all of them.
+template <int Features, int Bounces>
+vec3f cast_ray_kernel(const vec3f& orig, const vec3f& dir, const Scene& scene, const Render_settings& settings, Primary_hit* first_hit,
+                      const Sphere_range* candidates) {
+    constexpr bool plane = (Features & KERNEL_PLANE) != 0;
     vec3f point, N;
     Material material;
-    
-    if (depth > 4 || !scene_intersect(orig, dir, spheres, point, N, material)) {
-        return vec3f(0.2, 0.7, 0.8); // background color
+
+    int object = -1;
+
+    if (Bounces < 0 || !scene_intersect<plane>(orig, dir, scene, point, N, material, first_hit ? &object : NULL, candidates)) {
+        if (first_hit) *first_hit = { vec3f(0, 0, 0), BACKGROUND, FAR_DEPTH, -1, -1 };
+        return BACKGROUND;
     }
+    if (first_hit) *first_hit = { N, material.diffuse_color, (point - orig).norm(), material.id, object };
 
+    vec3f reflect_color, refract_color;
+    if constexpr (Bounces >= 0 && (Features & KERNEL_REFLECTION) != 0) {
+        vec3f reflect_dir = reflect(dir, N).normalize();
+        vec3f reflect_orig = reflect_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3; // offset the original point to avoid occlusion by the object itself
+        RAY_STAT(reflection, Bounces > 0);
+        reflect_color = cast_ray_kernel<Features, Bounces - 1>(reflect_orig, reflect_dir, scene, settings, NULL, NULL);
+    }
+    if constexpr (Bounces >= 0 && (Features & KERNEL_REFRACTION) != 0) {
+        vec3f refract_dir = refract(dir, N, material.refractive_index).normalize();
+        vec3f refract_orig = refract_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3;
+        RAY_STAT(refraction, Bounces > 0);
+        refract_color = cast_ray_kernel<Features, Bounces - 1>(refract_orig, refract_dir, scene, settings, NULL, NULL);
+    }
 
-    vec3f reflect_dir = reflect(dir, N).normalize();
-    vec3f refract_dir = refract(dir, N, material.refractive_index).normalize();
-    vec3f reflect_orig = reflect_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3; // offset the original point to avoid occlusion by the object itself
-    vec3f refract_orig = refract_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3;
-    vec3f reflect_color = cast_ray(reflect_orig, reflect_dir, spheres, lights, depth + 1);
-    vec3f refract_color = cast_ray(refract_orig, refract_dir, spheres, lights, depth + 1);
+    vec3f color = direct_light<Features>(point, N, dir, material, scene, settings);
+    if constexpr ((Features & KERNEL_REFLECTION) != 0) color = color + reflect_color * material.albedo.raw[2];
+    if constexpr ((Features & KERNEL_REFRACTION) != 0) color = color + refract_color * material.albedo.raw[3];
+    return color;
+}
 
-    float diffuse_light_intensity = 0, specular_light_intensity = 0;
-    for (size_t i = 0; i < lights.size(); i++) {
-        vec3f light_dir = (lights[i].position - point).normalize();
-        float light_distance = (lights[i].position - point).norm();
+template <int... Features>
+Cast_ray_kernel select_kernel(int features, int max_depth, std::integer_sequence<int, Features...>) {
+    static const Cast_ray_kernel kernels[][MAX_DEPTH + 1] = {
+        { cast_ray_kernel<Features, 0>, cast_ray_kernel<Features, 1>, cast_ray_kernel<Features, 2>, cast_ray_kernel<Features, 3>, cast_ray_kernel<Features, 4> }...
+    };
+    return kernels[features][max_depth];
+}
 
-        vec3f shadow_orig = light_dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3; // checking if the point lies in the shadow of the lights[i]
-        vec3f shadow_pt, shadow_N;
-        Material tmpmaterial;
-        if (scene_intersect(shadow_orig, light_dir, spheres, shadow_pt, shadow_N, tmpmaterial) && (shadow_pt - shadow_orig).norm() < light_distance)
-            continue;
+// kernel for the scene features and the settings, light sampling and cutoff need the light tree
+Cast_ray_kernel select_kernel(const Scene& scene, const Render_settings& settings) {
+    int features = scene.features;
+    if (settings.light_samples > 0 || settings.light_cutoff > 0) features |= KERNEL_LIGHT_TREE;
+    int max_depth = max(0, min(MAX_DEPTH, settings.max_depth));
+    return select_kernel(features, max_depth, std::make_integer_sequence<int, KERNEL_FEATURES_COUNT>());
+}
 
-        diffuse_light_intensity += lights[i].intensity * max(0.f, light_dir * N);
-        specular_light_intensity += powf(max(0.f, -reflect(-light_dir, N) * dir), material.specular_exponent) * lights[i].intensity;
-    }
-    return material.diffuse_color * diffuse_light_intensity * material.albedo.raw[0] + vec3f(1., 1., 1.) * specular_light_intensity * material.albedo.raw[1] + reflect_color * material.albedo.raw[2] + refract_color * material.albedo.raw[3];
+vec3f cast_ray(const vec3f& orig, const vec3f& dir, const Scene& scene, const Render_settings& settings) {
+    return select_kernel(scene, settings)(orig, dir, scene, settings, NULL, NULL);
 }
 
-void render(Image& surface, std::vector<Sphere>& spheres, const std::vector<Light>& lights) {
-    const int width = surface.width;
-    const int height = surface.height;
+
+// direction of the camera ray through x, y in pixels
+inline vec3f camera_ray(const Camera& camera, float x, float y, int width, int height) {
+    const int fov = PI / 2.0f;
+    float dir_x = (2 * x / (float)width - 1.0f) * tan(fov / 2.0f) * width / (float)height;
+    float dir_y = -(2 * y / (float)height - 1.0f) * tan(fov / 2.0f);
+    return camera.to_world(vec3f(dir_x, dir_y, -1).normalize());
+}
+
+// the other way around, where point is seen in pixels and how far it is, false if it is behind the camera
+inline bool camera_project(const Camera& camera, const vec3f& point, int width, int height, float& x, float& y, float& distance) {
     const int fov = PI / 2.0f;
+    vec3f q = point - camera.position;
+    float depth = q * camera.forward;
+    if (depth <= 1e-4f) return false;
+
+    float dir_x = q * camera.right / depth;
+    float dir_y = q * camera.up / depth;
+    x = (dir_x / (tan(fov / 2.0f) * width / (float)height) + 1.0f) * width * 0.5f;
+    y = (1.0f - dir_y / tan(fov / 2.0f)) * height * 0.5f;
+    distance = q.norm();
+    return true;
+}
+
+
+#define BIN_MIN_SPHERES 16   // fewer are tested by two AVX batches, binning them doesn't pay
+
+// The spheres of the scene binned by the render tiles their bounding box projects onto, so the
+// camera rays of a tile are only tested against the few spheres that can be in it. The bins are
+// packed one after the other into a Sphere_soa, each padded to 8 lanes and in scene order, so on
+// equal distance the same sphere wins as without them. The bounces and shadow rays don't start at
+// the camera and test every sphere.
+struct Tile_bins
+{
+    Sphere_soa lanes;
+    std::vector<int> first;   // first lane of every tile, and the lane count at the end
+    Crop_window window;       // the pixels the tiles cover, starting at its corner
+    int tile_size = 0, tiles_x = 0, tiles_y = 0;
+
+    void build(const Scene& scene, const Camera& camera, const Crop_window& window, int tile_size)
+    {
+        PROFILE_ZONE("tile bins");
+        this->window = window;
+        this->tile_size = tile_size;
+        tiles_x = (window.width() + tile_size - 1) / tile_size;
+        tiles_y = (window.height() + tile_size - 1) / tile_size;
+        const int tiles = tiles_x * tiles_y;
+        const int count = (int)scene.spheres.size();
+
+        // the tiles every sphere covers, then the lanes of every tile
+        std::vector<int> rects(4 * count), next(tiles, 0);
+        for (int i = 0; i < count; i++)
+        {
+            int* rect = &rects[4 * i];
+            cover(scene.spheres[i], camera, rect);
+            for (int ty = rect[1]; ty <= rect[3]; ty++)
+                for (int tx = rect[0]; tx <= rect[2]; tx++) next[tx + ty * tiles_x]++;
+        }
+        first.resize(tiles + 1);
+        first[0] = 0;
+        for (int tile = 0; tile < tiles; tile++)
+        {
+            first[tile + 1] = first[tile] + ((next[tile] + 7) & ~7);
+            next[tile] = first[tile];
+        }
 
-#pragma omp parallel for
-    for (size_t j = 0; j < height; j++) {
-        for (size_t i = 0; i < width; i++) {
-            float x = (2 * (i + 0.5f) / (float)width - 1.0f) * tan(fov / 2.0f) * width / (float)height;
-            float y = -(2 * (j + 0.5f) / (float)height - 1.0f) * tan(fov / 2.0f);
-            vec3f dir = vec3f(x, y, -1).normalize();
-            surface[i + j * width] = vec_color(cast_ray(vec3f(0, 0, 0), dir, spheres, lights));
+        lanes.count = first[tiles];
+        lanes.x.assign(lanes.count, 0);
+        lanes.y.assign(lanes.count, 0);
+        lanes.z.assign(lanes.count, 0);
+        lanes.r2.assign(lanes.count, -1);
+        lanes.ids.assign(lanes.count, 0);
+        for (int i = 0; i < count; i++)
+        {
+            const Sphere& sphere = scene.spheres[i];
+            const int* rect = &rects[4 * i];
+            for (int ty = rect[1]; ty <= rect[3]; ty++)
+                for (int tx = rect[0]; tx <= rect[2]; tx++)
+                {
+                    int lane = next[tx + ty * tiles_x]++;
+                    lanes.x[lane] = sphere.center.x;
+                    lanes.y[lane] = sphere.center.y;
+                    lanes.z[lane] = sphere.center.z;
+                    lanes.r2[lane] = sphere.radius * sphere.radius;
+                    lanes.ids[lane] = i;
+                }
         }
     }
-}
\ No newline at end of file
+
+    // the bin of the render tile x0, y0, x1, y1, false if it isn't one of the tiles
+    bool find(int x0, int y0, int x1, int y1, Sphere_range& range) const
+    {
+        const int dx = x0 - window.x0, dy = y0 - window.y0;
+        if (tile_size <= 0 || dx < 0 || dy < 0 || dx % tile_size || dy % tile_size || x1 - x0 > tile_size || y1 - y0 > tile_size ||
+            x1 > window.x1 || y1 > window.y1)
+            return false;
+        const int tile = dx / tile_size + dy / tile_size * tiles_x;
+        range = { &lanes, first[tile], first[tile + 1] };
+        return true;
+    }
+
+private:
+    // the tiles, inclusive, the projection of sphere's bounding box covers as x0, y0, x1, y1, all of
+    // them if the box reaches behind the camera and none (x0 > x1) if it is off the window
+    void cover(const Sphere& sphere, const Camera& camera, int* rect) const
+    {
+        float min_x = (std::numeric_limits<float>::max)(), min_y = min_x, max_x = -min_x, max_y = -min_x;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const float r = sphere.radius;
+            vec3f point = sphere.center + vec3f(corner & 1 ? r : -r, corner & 2 ? r : -r, corner & 4 ? r : -r);
+            float x, y, distance;
+            if (!camera_project(camera, point, window.frame_width, window.frame_height, x, y, distance))
+            {
+                rect[0] = rect[1] = 0;
+                rect[2] = tiles_x - 1;
+                rect[3] = tiles_y - 1;
+                return;
+            }
+            min_x = (std::min)(min_x, x);
+            min_y = (std::min)(min_y, y);
+            max_x = (std::max)(max_x, x);
+            max_y = (std::max)(max_y, y);
+        }
+
+        // the pixels whose rays can reach the box and one more on every side for the rounding,
+        // clamped before the conversion, a box close to the camera plane projects very far out
+        const int x0 = (int)floorf((std::max)(min_x, window.x0 - 4.0f)) - 2;
+        const int y0 = (int)floorf((std::max)(min_y, window.y0 - 4.0f)) - 2;
+        const int x1 = (int)floorf((std::min)(max_x, window.x1 + 4.0f)) + 1;
+        const int y1 = (int)floorf((std::min)(max_y, window.y1 + 4.0f)) + 1;
+        if (x1 < window.x0 || y1 < window.y0 || x0 >= window.x1 || y0 >= window.y1)
+        {
+            rect[0] = rect[1] = 0;
+            rect[2] = rect[3] = -1;
+            return;
+        }
+        rect[0] = (std::max)(x0 - window.x0, 0) / tile_size;
+        rect[1] = (std::max)(y0 - window.y0, 0) / tile_size;
+        rect[2] = (std::min)(x1 - window.x0, window.width() - 1) / tile_size;
+        rect[3] = (std::min)(y1 - window.y0, window.height() - 1) / tile_size;
+    }
+};
+
+// bins for the tiles of window if the settings ask for them and the scene has enough spheres,
+// otherwise NULL and the camera rays test every sphere
+const Tile_bins* bin_spheres(Tile_bins& bins, const Scene& scene, const Render_settings& settings, const Crop_window& window) {
+    if (!settings.primary_bins || scene.spheres.size() < BIN_MIN_SPHERES) return NULL;
+    bins.build(scene, settings.camera, window, settings.tile_size);
+    return &bins;
+}
+
+#define JITTER_BATCH 64   // samples of a pixel whose camera jitter is made at once
+
+// Writes the linear color of every pixel of the tile into hdr, averaged over settings.samples
+// jittered rays. The random numbers only depend on the pixel and the sample, not on the tile or
+// the thread. stats, if given, gets the counters of the tile and the cost of its pixels, it
+// must be reset for the tile grid. aovs, if given, gets the first hits in its enabled planes.
+// bins, if given and it has the tile, limits the spheres its camera rays are tested against.
+// The tile is in frame pixels, hdr, aovs and the cost image cover the frame or settings.crop.
+void render_tile(fImage& hdr, const Scene& scene, const Render_settings& settings, Cast_ray_kernel kernel, int x0, int y0, int x1, int y1,
+                 Render_stats* stats = NULL, Aov_buffers* aovs = NULL, const Tile_bins* bins = NULL) {
+    PROFILE_ZONE("tile");
+    int width, height, origin_x, origin_y;
+    settings.crop.place(hdr.width, hdr.height, width, height, origin_x, origin_y);
+    const int samples = max(settings.samples, 1);
+    const float inv_samples = 1.0f / samples;
+    const bool jitter = samples > 1 || settings.jitter;
+    float jitter_xy[2 * JITTER_BATCH];
+    Sphere_range bin;
+    const Sphere_range* candidates = bins && bins->find(x0, y0, x1, y1, bin) ? &bin : NULL;
+#ifdef RAY_STATS
+    Ray_stats before = ray_stats;
+#endif
+
+    fImage* cost = stats ? stats->cost : NULL;
+
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++) {
+            uint64_t start = cost ? cost_counter(stats->cost_metric) : 0;
+            vec3f color(0, 0, 0);
+            Primary_hit first = {}, hit;
+
+            for (int s = 0; s < samples; s++) {
+                // a single sample goes through the pixel center, the shading starts at dimension 2 either way
+                const int batch = s % JITTER_BATCH;
+                if (jitter && batch == 0)
+                    sample_jitter(settings.sampler, i, j, settings.first_sample + s, min(samples - s, JITTER_BATCH), settings.seed, jitter_xy);
+                float jitter_x = jitter ? jitter_xy[2 * batch] : 0.5f;
+                float jitter_y = jitter ? jitter_xy[2 * batch + 1] : 0.5f;
+                start_sample(settings.sampler, i, j, settings.first_sample + s, settings.seed, 2);
+                vec3f dir = camera_ray(settings.camera, i + jitter_x, j + jitter_y, width, height);
+                RAY_STAT(primary, 1);
+
+                color = color + kernel(settings.camera.position, dir, scene, settings, aovs ? &hit : NULL, candidates);
+                if (!aovs) continue;
+
+                if (s == 0) {
+                    first = hit;
+                    continue;
+                }
+                first.normal = first.normal + hit.normal;
+                first.albedo = first.albedo + hit.albedo;
+                first.depth += hit.depth;
+            }
+
+            const int idx = (i - origin_x) + (j - origin_y) * hdr.width;
+            hdr[idx] = fColor(color.x * inv_samples, color.y * inv_samples, color.z * inv_samples);
+            if (aovs) {
+                first.normal = first.normal * inv_samples;
+                first.albedo = first.albedo * inv_samples;
+                first.depth *= inv_samples;
+                aovs->set(idx, first);
+            }
+            if (cost) (*cost)[idx] = fColor(float(cost_counter(stats->cost_metric) - start));
+        }
+    }
+
+#ifdef RAY_STATS
+    // render() starts the tile grid at the crop's corner
+    const int grid_x = settings.crop.empty() ? 0 : settings.crop.x0;
+    const int grid_y = settings.crop.empty() ? 0 : settings.crop.y0;
+    if (stats) stats->add_tile((y0 - grid_y) / settings.tile_size * stats->tiles_x + (x0 - grid_x) / settings.tile_size, ray_stats - before);
+#endif
+}
+
+// the pixels render() traces, settings.crop or all of hdr
+inline Crop_window render_window(const fImage& hdr, const Render_settings& settings) {
+    return settings.crop.empty() ? Crop_window::pixels(0, 0, hdr.width, hdr.height, hdr.width, hdr.height) : settings.crop;
+}
+
+// Linear colors only, tonemap() turns them into pixels. stats, if given, gets the ray counters of
+// the render, they are only counted in RAY_STATS builds. aovs, if given, must be resized to hdr and
+// gets the first hits in its enabled planes, denoise() needs DENOISE_AOVS. With settings.crop, hdr
+// (and aovs and the cost image) is either the whole frame or only the crop.
+void render(fImage& hdr, const Scene& scene, const Render_settings& settings = Render_settings(), Render_stats* stats = NULL,
+            Aov_buffers* aovs = NULL) {
+    PROFILE_ZONE("render");
+    if (aovs && !aovs->enabled) aovs = NULL;
+    assert(!aovs || (aovs->width == hdr.width && aovs->height == hdr.height));
+    Cast_ray_kernel kernel = select_kernel(scene, settings);
+    Crop_window window = render_window(hdr, settings);
+    Tile_bins bins;
+    const Tile_bins* primary = bin_spheres(bins, scene, settings, window);
+    if (stats) stats->reset((window.width() + settings.tile_size - 1) / settings.tile_size, (window.height() + settings.tile_size - 1) / settings.tile_size);
+
+    workers.parallel_for_2d(window.x0, window.y0, window.x1, window.y1, settings.tile_size, settings.tile_size, [&](int x0, int y0, int x1, int y1) {
+        render_tile(hdr, scene, settings, kernel, x0, y0, x1, y1, stats, aovs, primary);
+    });
+}
+
+// renders into hdr and converts every tile into surface with settings.tonemap while it is still in the cache
+void render(Image& surface, fImage& hdr, const Scene& scene, const Render_settings& settings = Render_settings(), Render_stats* stats = NULL) {
+    PROFILE_ZONE("render");
+    Cast_ray_kernel kernel = select_kernel(scene, settings);
+    Crop_window window = render_window(hdr, settings);
+    int width, height, origin_x, origin_y;
+    settings.crop.place(hdr.width, hdr.height, width, height, origin_x, origin_y);
+    Tile_bins bins;
+    const Tile_bins* primary = bin_spheres(bins, scene, settings, window);
+    if (stats) stats->reset((window.width() + settings.tile_size - 1) / settings.tile_size, (window.height() + settings.tile_size - 1) / settings.tile_size);
+
+    workers.parallel_for_2d(window.x0, window.y0, window.x1, window.y1, settings.tile_size, settings.tile_size, [&](int x0, int y0, int x1, int y1) {
+        render_tile(hdr, scene, settings, kernel, x0, y0, x1, y1, stats, NULL, primary);
+        tonemap(hdr, surface, settings.tonemap, x0 - origin_x, y0 - origin_y, x1 - origin_x, y1 - origin_y);
+    });
+}
+
+
+// A render running in the background, one pool task per tile at the job's priority. A preview
+// job with a higher priority gets the workers as soon as their current tiles are done and
+// cancel() skips every tile that hasn't started. Tiles are rendered into hdr and tonemapped into
+// surface before on_tile, the images and the scene must outlive the job. With settings.crop only
+// the crop is tiled, hdr and surface are the whole frame or only the crop as for render().
+struct Render_job
+{
+    typedef std::function<void(int x0, int y0, int x1, int y1)> Tile_callback;
+    typedef std::function<void(bool cancelled)> Done_callback;
+
+    Image& surface;
+    fImage& hdr;
+    const Scene& scene;
+    Render_settings settings;
+    Cast_ray_kernel kernel;
+    Crop_window window;      // the pixels rendered, see render_window()
+    int origin_x, origin_y;  // the frame pixel at hdr's corner
+    int tiles_x, tiles_y;
+    Tile_bins bins;
+    const Tile_bins* primary;
+
+    Tile_callback on_tile;   // called on the worker after each rendered tile, in surface pixels
+    Done_callback on_done;   // called once by the thread that finishes the last tile
+    Render_stats stats;      // complete once the job is finished
+
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> remaining;          // tiles not yet rendered or skipped
+    std::atomic<bool> complete{false};   // set after on_done returned
+    std::mutex done_mutex;
+    std::condition_variable done;
+
+    Render_job(Image& surface, fImage& hdr, const Scene& scene, const Render_settings& settings) :
+        surface(surface), hdr(hdr), scene(scene), settings(settings), kernel(select_kernel(scene, settings))
+    {
+        window = render_window(hdr, settings);
+        int width, height;
+        settings.crop.place(hdr.width, hdr.height, width, height, origin_x, origin_y);
+        tiles_x = (window.width() + settings.tile_size - 1) / settings.tile_size;
+        tiles_y = (window.height() + settings.tile_size - 1) / settings.tile_size;
+        remaining = tiles_x * tiles_y;
+        stats.reset(tiles_x, tiles_y);
+        primary = bin_spheres(bins, scene, settings, window);
+    }
+
+    void cancel() { cancelled = true; }
+    bool is_cancelled() const { return cancelled; }
+    bool finished() const { return complete; }
+
+    // helps with queued tasks until every tile is rendered or skipped
+    void wait()
+    {
+        while (!finished())
+        {
+            if (workers.try_run_one()) continue;
+
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done.wait_for(lock, std::chrono::milliseconds(1), [&]() { return finished(); });
+        }
+
+        // finish() may still hold the mutex after complete was set, the job mustn't go away before it's left
+        std::unique_lock<std::mutex> lock(done_mutex);
+    }
+
+    void run_tile(int tile)
+    {
+        if (!cancelled)
+        {
+            int x0 = window.x0 + (tile % tiles_x) * settings.tile_size;
+            int y0 = window.y0 + (tile / tiles_x) * settings.tile_size;
+            int x1 = min(x0 + settings.tile_size, window.x1);
+            int y1 = min(y0 + settings.tile_size, window.y1);
+
+            render_tile(hdr, scene, settings, kernel, x0, y0, x1, y1, &stats, NULL, primary);
+            tonemap(hdr, surface, settings.tonemap, x0 - origin_x, y0 - origin_y, x1 - origin_x, y1 - origin_y);
+            if (on_tile) on_tile(x0 - origin_x, y0 - origin_y, x1 - origin_x, y1 - origin_y);
+        }
+
+        if (--remaining == 0) finish();
+    }
+
+    // after the last tile, or right away for a job without tiles
+    void finish()
+    {
+        if (on_done) on_done(cancelled);
+
+        std::unique_lock<std::mutex> lock(done_mutex);
+        complete = true;
+        done.notify_all();
+    }
+};
+
+// starts rendering and returns right away, the pool keeps the job alive until its last tile
+std::shared_ptr<Render_job> render_async(Image& surface, fImage& hdr, const Scene& scene, const Render_settings& settings = Render_settings(),
+                                         task_priority priority = PRIORITY_NORMAL,
+                                         Render_job::Tile_callback on_tile = nullptr, Render_job::Done_callback on_done = nullptr) {
+    auto job = std::make_shared<Render_job>(surface, hdr, scene, settings);
+    job->on_tile = std::move(on_tile);
+    job->on_done = std::move(on_done);
+    // no task would be left to finish an empty job, and once the tasks are queued the last one owns it
+    if (job->remaining == 0)
+        job->finish();
+    else
+        workers.add_tasks(job->tiles_x * job->tiles_y, [job](size_t tile) { job->run_tile(tile); }, priority);
+    return job;
+}
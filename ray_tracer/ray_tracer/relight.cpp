@@ -0,0 +1,187 @@
+// Relighting after light only edits. Where the camera rays and their mirror and glass bounces go
+// depends on the geometry alone, the lights only change what is seen at the surfaces they hit.
+// capture_paths() traces the paths once and keeps every surface on them, relight() only shades
+// those again with the current lights, the shadow rays included.
+
+// a surface on a camera path, its direct light reaches the pixel scaled by weight
+struct Shading_point
+{
+    vec3f point, N;
+    vec3f dir;           // of the ray that hit it
+    float weight;        // reflection/refraction albedos on the way there over the samples of the pixel
+    Material material;   // a copy, the checkerboard's color depends on the point
+};
+
+// the paths of one render tile, pixel after pixel
+struct Relight_tile
+{
+    std::vector<Shading_point> points;
+    std::vector<int> counts;          // points of each pixel
+    std::vector<vec3f> background;    // what the rays of each pixel that hit nothing add
+};
+
+// Valid as long as the spheres, the image size and the settings besides the light ones don't
+// change. Captured again it reuses the memory of the tiles.
+struct Relight_cache
+{
+    int width = 0, height = 0;
+    int tile_size = 0, tiles_x = 0;
+    std::vector<Relight_tile> tiles;
+
+    size_t size() const
+    {
+        size_t points = 0;
+        for (const Relight_tile& tile : tiles) points += tile.points.size();
+        return points;
+    }
+};
+
+
+// cast_ray_kernel without the shading, the surfaces the ray reaches go into tile instead
+template <int Features, int Bounces>
+void capture_path(const vec3f& orig, const vec3f& dir, const Scene& scene, float weight, Relight_tile& tile, vec3f& background) {
+    constexpr bool plane = (Features & KERNEL_PLANE) != 0;
+    Shading_point hit;
+
+    if (Bounces < 0 || !scene_intersect<plane>(orig, dir, scene, hit.point, hit.N, hit.material)) {
+        background = background + BACKGROUND * weight;
+        return;
+    }
+    hit.dir = dir;
+    hit.weight = weight;
+    tile.points.push_back(hit);
+
+    // bounces that can't contribute aren't followed
+    if constexpr (Bounces >= 0 && (Features & KERNEL_REFLECTION) != 0) {
+        float reflect_weight = weight * hit.material.albedo.raw[2];
+        if (reflect_weight != 0) {
+            vec3f reflect_dir = reflect(dir, hit.N).normalize();
+            vec3f reflect_orig = reflect_dir * hit.N < 0 ? hit.point - hit.N * 1e-3 : hit.point + hit.N * 1e-3;
+            RAY_STAT(reflection, Bounces > 0);
+            capture_path<Features, Bounces - 1>(reflect_orig, reflect_dir, scene, reflect_weight, tile, background);
+        }
+    }
+    if constexpr (Bounces >= 0 && (Features & KERNEL_REFRACTION) != 0) {
+        float refract_weight = weight * hit.material.albedo.raw[3];
+        if (refract_weight != 0) {
+            vec3f refract_dir = refract(dir, hit.N, hit.material.refractive_index).normalize();
+            vec3f refract_orig = refract_dir * hit.N < 0 ? hit.point - hit.N * 1e-3 : hit.point + hit.N * 1e-3;
+            RAY_STAT(refraction, Bounces > 0);
+            capture_path<Features, Bounces - 1>(refract_orig, refract_dir, scene, refract_weight, tile, background);
+        }
+    }
+}
+
+typedef void (*Capture_kernel)(const vec3f& orig, const vec3f& dir, const Scene& scene, float weight, Relight_tile& tile, vec3f& background);
+
+template <int... Features>
+Capture_kernel select_capture_kernel(int features, int max_depth, std::integer_sequence<int, Features...>) {
+    static const Capture_kernel kernels[][MAX_DEPTH + 1] = {
+        { capture_path<Features, 0>, capture_path<Features, 1>, capture_path<Features, 2>, capture_path<Features, 3>, capture_path<Features, 4> }...
+    };
+    return kernels[features][max_depth];
+}
+
+// the same camera rays as render_tile
+void capture_tile(Relight_tile& tile, const Scene& scene, const Render_settings& settings, Capture_kernel kernel,
+                  int x0, int y0, int x1, int y1, int width, int height) {
+    PROFILE_ZONE("capture tile");
+    const int samples = max(settings.samples, 1);
+    const float inv_samples = 1.0f / samples;
+    const bool jitter = samples > 1 || settings.jitter;
+
+    tile.points.clear();
+    tile.counts.clear();
+    tile.background.clear();
+
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++) {
+            size_t first = tile.points.size();
+            vec3f background(0, 0, 0);
+
+            for (int s = 0; s < samples; s++) {
+                float xy[2];
+                if (jitter) sample_jitter(settings.sampler, i, j, settings.first_sample + s, 1, settings.seed, xy);
+                float jitter_x = jitter ? xy[0] : 0.5f;
+                float jitter_y = jitter ? xy[1] : 0.5f;
+                RAY_STAT(primary, 1);
+                kernel(settings.camera.position, camera_ray(settings.camera, i + jitter_x, j + jitter_y, width, height), scene, inv_samples, tile, background);
+            }
+            tile.counts.push_back(tile.points.size() - first);
+            tile.background.push_back(background);
+        }
+    }
+}
+
+// Traces the camera paths of a width x height frame into cache. The shading settings (light
+// samples, cutoff, shadow cache) are free to change between relight() calls, the others are not.
+void capture_paths(Relight_cache& cache, int width, int height, const Scene& scene, const Render_settings& settings = Render_settings()) {
+    PROFILE_ZONE("capture paths");
+    int max_depth = max(0, min(MAX_DEPTH, settings.max_depth));
+    Capture_kernel kernel = select_capture_kernel(scene.features & ~KERNEL_LIGHT_TREE, max_depth, std::make_integer_sequence<int, KERNEL_FEATURES_COUNT>());
+
+    cache.width = width;
+    cache.height = height;
+    cache.tile_size = settings.tile_size;
+    cache.tiles_x = (width + settings.tile_size - 1) / settings.tile_size;
+    cache.tiles.resize(cache.tiles_x * ((height + settings.tile_size - 1) / settings.tile_size));
+
+    workers.parallel_for_2d(0, 0, width, height, settings.tile_size, settings.tile_size, [&](int x0, int y0, int x1, int y1) {
+        Relight_tile& tile = cache.tiles[y0 / cache.tile_size * cache.tiles_x + x0 / cache.tile_size];
+        capture_tile(tile, scene, settings, kernel, x0, y0, x1, y1, width, height);
+    });
+}
+
+
+template <int Features>
+void relight_tile(fImage& hdr, const Relight_tile& tile, const Scene& scene, const Render_settings& settings, int x0, int y0, int x1, int y1) {
+    PROFILE_ZONE("relight tile");
+    const Shading_point* point = tile.points.data();
+    int pixel = 0;
+
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++, pixel++) {
+            // the points of all samples draw from the first one's dimensions, the lights are sampled
+            // the same way on every relight
+            start_sample(settings.sampler, i, j, settings.first_sample, settings.seed, 2);
+            vec3f color = tile.background[pixel];
+            for (int n = tile.counts[pixel]; n > 0; n--, point++)
+                color = color + direct_light<Features>(point->point, point->N, point->dir, point->material, scene, settings) * point->weight;
+            hdr[i + j * hdr.width] = fColor(color.x, color.y, color.z);
+        }
+    }
+}
+
+typedef void (*Relight_kernel)(fImage& hdr, const Relight_tile& tile, const Scene& scene, const Render_settings& settings, int x0, int y0, int x1, int y1);
+
+template <int... Features>
+Relight_kernel select_relight_kernel(int features, std::integer_sequence<int, Features...>) {
+    static const Relight_kernel kernels[] = { relight_tile<Features>... };
+    return kernels[features];
+}
+
+// Shades the captured paths with the current lights into the linear colors of hdr, which must be
+// the size of the capture. Call scene.build_lights() after editing the lights.
+void relight(fImage& hdr, const Relight_cache& cache, const Scene& scene, const Render_settings& settings = Render_settings()) {
+    PROFILE_ZONE("relight");
+    assert(hdr.width == cache.width && hdr.height == cache.height);
+    int features = scene.features;
+    if (settings.light_samples > 0 || settings.light_cutoff > 0) features |= KERNEL_LIGHT_TREE;
+    Relight_kernel kernel = select_relight_kernel(features, std::make_integer_sequence<int, KERNEL_FEATURES_COUNT>());
+
+    workers.parallel_for_2d(0, 0, cache.width, cache.height, cache.tile_size, cache.tile_size, [&](int x0, int y0, int x1, int y1) {
+        const Relight_tile& tile = cache.tiles[y0 / cache.tile_size * cache.tiles_x + x0 / cache.tile_size];
+        kernel(hdr, tile, scene, settings, x0, y0, x1, y1);
+    });
+}
+
+// The light edit of -relight: turns every light by angle radians around the vertical axis through
+// center and rebuilds the light tree, the geometry and so the captured paths stay valid.
+void orbit_lights(Scene& scene, const vec3f& center, float angle) {
+    float c = cosf(angle), s = sinf(angle);
+    for (Light& light : scene.lights) {
+        vec3f d = light.position - center;
+        light.position = center + vec3f(d.x * c - d.z * s, d.y, d.x * s + d.z * c);
+    }
+    scene.build_lights();
+}
@@ -0,0 +1,313 @@
+// Random numbers that depend on what they're for instead of on who asks: every number is a function
+// of the pixel, the sample index, the dimension (0 and 1 jitter the camera ray, the ones after are
+// drawn by the shading in the order it asks) and the render's seed. Which thread renders a tile and
+// in what order doesn't matter, so renders are the same for any thread count, tile order or process.
+// Dimensions come in pairs from one of three samplers:
+//   random      Philox2x32-10, counter (pixel, sample and pair), key the seed
+//   sobol       the first two Sobol dimensions, index shuffled and values Owen scrambled per pixel
+//               and pair with hashes (Burley 2020), stratified over the samples of each pixel
+//   blue noise  one scrambled Sobol sequence for the whole image, rotated per pixel by a blue noise
+//               mask (Cranley-Patterson), so the error of low sample counts has no low frequencies
+
+#include <random>
+
+enum Sampler_type
+{
+    SAMPLER_RANDOM,
+    SAMPLER_SOBOL,
+    SAMPLER_BLUE_NOISE,
+};
+
+// 24 bits into [0, 1)
+inline float to_unit_float(uint32_t bits)
+{
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// lowbias32, a full avalanche 32 bit hash
+inline uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// pixels up to 65536 on a side, the key is the same for a pixel of a crop and of the whole image
+inline uint32_t pixel_key(uint32_t x, uint32_t y)
+{
+    return x | (y << 16);
+}
+
+
+// ===================== Philox =====================
+
+#define PHILOX_M 0xd256d193u
+#define PHILOX_W 0x9e3779b9u
+
+// dimensions 2 * pair and 2 * pair + 1, samples up to 2^24 and 256 pairs per sample
+inline void philox_pair(uint32_t pixel, uint32_t sample, uint32_t pair, uint32_t seed, uint32_t out[2])
+{
+    uint32_t x0 = pixel, x1 = (sample << 8) | pair, key = seed;
+    for (int round = 0; round < 10; round++, key += PHILOX_W)
+    {
+        uint64_t product = (uint64_t)PHILOX_M * x0;
+        x0 = (uint32_t)(product >> 32) ^ key ^ x1;
+        x1 = (uint32_t)product;
+    }
+    out[0] = x0;
+    out[1] = x1;
+}
+
+// the same for 4 samples at once, SSE2 only has the 32 x 32 -> 64 bit multiply on the even lanes
+inline void philox_pair(__m128i pixel, __m128i counter, uint32_t seed, __m128i& out0, __m128i& out1)
+{
+    const __m128i m = _mm_set1_epi32(PHILOX_M);
+    __m128i x0 = pixel, x1 = counter;
+    uint32_t key = seed;
+    for (int round = 0; round < 10; round++, key += PHILOX_W)
+    {
+        __m128i even = _mm_mul_epu32(x0, m);                         // lo0 hi0 lo2 hi2
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x0, 32), m);      // lo1 hi1 lo3 hi3
+        even = _mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0));     // lo0 lo2 hi0 hi2
+        odd = _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0));       // lo1 lo3 hi1 hi3
+        __m128i lo = _mm_unpacklo_epi32(even, odd);
+        __m128i hi = _mm_unpackhi_epi32(even, odd);
+        x0 = _mm_xor_si128(_mm_xor_si128(hi, _mm_set1_epi32(key)), x1);
+        x1 = lo;
+    }
+    out0 = x0;
+    out1 = x1;
+}
+
+
+// ===================== Sobol =====================
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// the second Sobol dimension, the first is reverse_bits(index)
+inline uint32_t sobol_1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// an Owen scramble: flipping a bit depends on the bits above it only
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+inline void sobol_pair(uint32_t sample, uint32_t seed, uint32_t out[2])
+{
+    uint32_t index = nested_uniform_scramble(sample, seed);
+    out[0] = nested_uniform_scramble(reverse_bits(index), hash32(seed ^ 0x1u));
+    out[1] = nested_uniform_scramble(sobol_1(index), hash32(seed ^ 0x2u));
+}
+
+
+// ===================== blue noise =====================
+
+#define BLUE_NOISE_SIZE 64   // a power of 2
+
+// void and cluster (Ulichney 1993) on a torus: ranks placed one after the other where the gaussian
+// weighted density is lowest, any threshold of them is evenly spread
+struct Blue_noise_mask
+{
+    uint32_t values[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE];   // rank scaled to 32 bits, the middle of its interval
+
+    Blue_noise_mask()
+    {
+        const int size = BLUE_NOISE_SIZE, n = size * size;
+        std::vector<float> kernel(n);
+        for (int dy = 0; dy < size; dy++)
+            for (int dx = 0; dx < size; dx++)
+            {
+                int wx = (std::min)(dx, size - dx), wy = (std::min)(dy, size - dy);
+                kernel[dx + dy * size] = expf(-(wx * wx + wy * wy) / (2.0f * 1.5f * 1.5f));
+            }
+
+        std::vector<uint8_t> ones(n, 0);
+        std::vector<float> energy(n, 0.0f);
+        auto toggle = [&](int p, bool on)
+        {
+            ones[p] = on;
+            const float sign = on ? 1.0f : -1.0f;
+            const int px = p % size, py = p / size;
+            for (int q = 0; q < n; q++)
+                energy[q] += sign * kernel[((q % size - px) & (size - 1)) + ((q / size - py) & (size - 1)) * size];
+        };
+        auto tightest_cluster = [&]()
+        {
+            int best = -1;
+            for (int p = 0; p < n; p++)
+                if (ones[p] && (best < 0 || energy[p] > energy[best])) best = p;
+            return best;
+        };
+        // among the zeros the lowest density of ones is also the tightest cluster of zeros, so
+        // this covers the upper half of the ranks too
+        auto largest_void = [&]()
+        {
+            int best = -1;
+            for (int p = 0; p < n; p++)
+                if (!ones[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            return best;
+        };
+
+        // a random tenth, then points moved from clusters to voids until none moves
+        std::mt19937 rng(1);
+        const int initial_count = n / 10;
+        for (int placed = 0; placed < initial_count;)
+        {
+            int p = rng() % n;
+            if (!ones[p])
+            {
+                toggle(p, true);
+                placed++;
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int cluster = tightest_cluster();
+            toggle(cluster, false);
+            int gap = largest_void();
+            toggle(gap, true);
+            if (gap == cluster) break;
+        }
+
+        std::vector<uint8_t> initial_ones = ones;
+        std::vector<float> initial_energy = energy;
+        std::vector<int> rank(n);
+        for (int r = initial_count - 1; r >= 0; r--)
+        {
+            int cluster = tightest_cluster();
+            toggle(cluster, false);
+            rank[cluster] = r;
+        }
+        ones = initial_ones;
+        energy = initial_energy;
+        for (int r = initial_count; r < n; r++)
+        {
+            int gap = largest_void();
+            toggle(gap, true);
+            rank[gap] = r;
+        }
+
+        for (int p = 0; p < n; p++)
+            values[p] = (uint32_t)(((2ull * rank[p] + 1) << 32) / (2ull * n));
+    }
+};
+
+// made on first use, about 50 ms
+inline const Blue_noise_mask& blue_noise_mask()
+{
+    static const Blue_noise_mask mask;
+    return mask;
+}
+
+inline void blue_noise_pair(uint32_t x, uint32_t y, uint32_t sample, uint32_t pair, uint32_t seed, uint32_t out[2])
+{
+    sobol_pair(sample, hash32(seed ^ hash32(pair)), out);
+    // each dimension reads the mask at its own offset, they'd be the same noise otherwise
+    const uint32_t* mask = blue_noise_mask().values;
+    const uint32_t mod = BLUE_NOISE_SIZE - 1;
+    out[0] += mask[((x + pair * 17) & mod) + ((y + pair * 41) & mod) * BLUE_NOISE_SIZE];
+    out[1] += mask[((x + pair * 17 + 32) & mod) + ((y + pair * 41 + 29) & mod) * BLUE_NOISE_SIZE];
+}
+
+
+// ===================== per sample streams =====================
+
+inline void sample_pair(int sampler, uint32_t x, uint32_t y, uint32_t sample, uint32_t pair, uint32_t seed, uint32_t out[2])
+{
+    switch (sampler)
+    {
+        case SAMPLER_SOBOL: sobol_pair(sample, hash32(seed ^ hash32(pixel_key(x, y) ^ hash32(pair))), out); break;
+        case SAMPLER_BLUE_NOISE: blue_noise_pair(x, y, sample, pair, seed, out); break;
+        default: philox_pair(pixel_key(x, y), sample, pair, seed, out); break;
+    }
+}
+
+// the dimensions of the sample the thread is working on, random_float() goes through them
+struct Sample_stream
+{
+    uint32_t x, y, sample, seed;
+    uint32_t dimension;
+    int sampler;
+    uint32_t pair[2];   // the numbers of dimension & ~1
+};
+
+thread_local Sample_stream sample_stream = {};
+
+inline void start_sample(int sampler, uint32_t x, uint32_t y, uint32_t sample, uint32_t seed, uint32_t dimension = 0)
+{
+    Sample_stream& stream = sample_stream;
+    stream.x = x;
+    stream.y = y;
+    stream.sample = sample;
+    stream.seed = seed;
+    stream.sampler = sampler;
+    stream.dimension = dimension;
+    if (dimension & 1) sample_pair(sampler, x, y, sample, dimension >> 1, seed, stream.pair);
+}
+
+// the next dimension of the current sample
+inline float random_float()
+{
+    Sample_stream& stream = sample_stream;
+    uint32_t dimension = stream.dimension++;
+    if ((dimension & 1) == 0) sample_pair(stream.sampler, stream.x, stream.y, stream.sample, dimension >> 1, stream.seed, stream.pair);
+    return to_unit_float(stream.pair[dimension & 1]);
+}
+
+// Dimensions 0 and 1 of count samples of a pixel from first on, as x, y pairs into xy. The
+// random sampler makes 4 samples at a time.
+void sample_jitter(int sampler, uint32_t x, uint32_t y, uint32_t first, int count, uint32_t seed, float* xy)
+{
+    const size_t n = count > 0 ? (size_t)count : 0;
+    size_t s = 0;
+    if (sampler == SAMPLER_RANDOM)
+    {
+        const __m128i pixel = _mm_set1_epi32(pixel_key(x, y));
+        const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+        for (; s + 4 <= n; s += 4)
+        {
+            // pair 0 in the low byte
+            __m128i counter = _mm_slli_epi32(_mm_add_epi32(_mm_set1_epi32(first + (uint32_t)s), _mm_setr_epi32(0, 1, 2, 3)), 8);
+            __m128i jx, jy;
+            philox_pair(pixel, counter, seed, jx, jy);
+            __m128 fx = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(jx, 8)), scale);
+            __m128 fy = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(jy, 8)), scale);
+            _mm_storeu_ps(xy + 2 * s, _mm_unpacklo_ps(fx, fy));
+            _mm_storeu_ps(xy + 2 * s + 4, _mm_unpackhi_ps(fx, fy));
+        }
+    }
+    for (; s < n; s++)
+    {
+        uint32_t pair[2];
+        sample_pair(sampler, x, y, first + (uint32_t)s, 0, seed, pair);
+        xy[2 * s] = to_unit_float(pair[0]);
+        xy[2 * s + 1] = to_unit_float(pair[1]);
+    }
+}
@@ -0,0 +1,87 @@
+#include <random>
+
+
+void load_default_scene(Scene& scene)
+{
+    Material      ivory(1.0, vec4f(0.6, 0.3, 0.1, 0.0), vec3f(0.4, 0.4, 0.3), 50.);
+    Material      glass(1.5, vec4f(0.0, 0.5, 0.1, 0.8), vec3f(0.6, 0.7, 0.8), 125.);
+    Material red_rubber(1.0, vec4f(0.9, 0.1, 0.0, 0.0), vec3f(0.3, 0.1, 0.1), 10.);
+    Material     mirror(1.0, vec4f(0.0, 10.0, 0.8, 0.0), vec3f(1.0, 1.0, 1.0), 1425.);
+
+    scene = Scene();
+    scene.spheres.push_back(Sphere(vec3f(-3, 0, -16), 2, ivory));
+    scene.spheres.push_back(Sphere(vec3f(-1.0, -1.5, -12), 2, glass));
+    scene.spheres.push_back(Sphere(vec3f(1.5, -0.5, -18), 3, red_rubber));
+    scene.spheres.push_back(Sphere(vec3f(7, 5, -18), 4, mirror));
+
+    scene.lights.push_back(Light(vec3f(-20, 20, 20), 1.5));
+    scene.lights.push_back(Light(vec3f(30, 50, -25), 1.8));
+    scene.lights.push_back(Light(vec3f(30, 20, 30), 1.7));
+    scene.build();
+}
+
+
+// small spheres scattered over the checkerboard with random lights above them,
+// the same seed always gives the same scene
+void load_random_scene(Scene& scene, int sphere_count, int light_count, uint32_t seed = 1)
+{
+    Material materials[] = {
+        Material(1.0, vec4f(0.6, 0.3, 0.1, 0.0), vec3f(0.4, 0.4, 0.3), 50.),
+        Material(1.5, vec4f(0.0, 0.5, 0.1, 0.8), vec3f(0.6, 0.7, 0.8), 125.),
+        Material(1.0, vec4f(0.9, 0.1, 0.0, 0.0), vec3f(0.3, 0.1, 0.1), 10.),
+        Material(1.0, vec4f(0.0, 10.0, 0.8, 0.0), vec3f(1.0, 1.0, 1.0), 1425.),
+    };
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> x(-10, 10), y(-4, 6), z(-30, -10), r(0.2f, 1.0f), light_pos(-50, 50);
+    std::uniform_int_distribution<int> material(0, 3);
+
+    scene = Scene();
+    for (int i = 0; i < sphere_count; i++)
+        scene.spheres.push_back(Sphere(vec3f(x(rng), y(rng), z(rng)), r(rng), materials[material(rng)]));
+
+    float intensity = 5.0f / light_count;
+    for (int i = 0; i < light_count; i++)
+        scene.lights.push_back(Light(vec3f(light_pos(rng), 20 + 0.5f * fabsf(light_pos(rng)), light_pos(rng)), intensity));
+    scene.build();
+}
+
+
+// only diffuse spheres and no checkerboard, the cheapest kernel
+void load_diffuse_scene(Scene& scene, int sphere_count, int light_count, uint32_t seed = 1)
+{
+    load_random_scene(scene, sphere_count, light_count, seed);
+    for (Sphere& sphere : scene.spheres)
+        sphere.material = Material(1.0, vec4f(0.9, 0.1, 0.0, 0.0), sphere.material.diffuse_color, 10.);
+    scene.checkerboard = false;
+    scene.build();
+}
+
+
+// the scene called name on a command line: default, random:SPHERES:LIGHTS or diffuse:SPHERES:LIGHTS,
+// the counts are 64 and 8 when they're left out, false for an unknown name
+bool load_scene(Scene& scene, const std::string& name)
+{
+    if (name.empty() || name == "default")
+    {
+        load_default_scene(scene);
+        return true;
+    }
+
+    size_t colon = name.find(':');
+    std::string kind = name.substr(0, colon);
+    int sphere_count = 64, light_count = 8;
+    if (colon != std::string::npos)
+    {
+        const char* counts = name.c_str() + colon + 1;
+        char* end;
+        sphere_count = (int)strtol(counts, &end, 10);
+        if (*end == ':') light_count = (int)strtol(end + 1, &end, 10);
+    }
+    if (sphere_count < 0 || light_count < 1) return false;
+
+    if (kind == "random") load_random_scene(scene, sphere_count, light_count);
+    else if (kind == "diffuse") load_diffuse_scene(scene, sphere_count, light_count);
+    else return false;
+    return true;
+}
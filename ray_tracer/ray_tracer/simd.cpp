@@ -0,0 +1,154 @@
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_BEGIN
+#define AVX_END
+#define SIMD_INLINE __forceinline
+#define SIMD_FLATTEN
+#else
+#include <cpuid.h>
+// gcc and clang only emit AVX inside functions that ask for it
+#define AVX_BEGIN _Pragma("GCC push_options") _Pragma("GCC target(\"avx\")")
+#define AVX_END _Pragma("GCC pop_options")
+// templates shared by the SSE and AVX paths must be inlined to pick up the caller's target
+// and the AVX kernels flatten them so the float8 operators end up inlined as well
+#define SIMD_INLINE inline __attribute__((always_inline))
+#define SIMD_FLATTEN __attribute__((flatten))
+#endif
+
+
+// ===================== cpu features =====================
+
+struct Cpu_features
+{
+	bool sse41 = false;
+	bool avx = false;
+	bool avx2 = false;
+	bool fma = false;
+};
+
+Cpu_features detect_cpu_features()
+{
+	Cpu_features res;
+	unsigned int regs[4] = {}, regs7[4] = {};
+	uint64_t xcr0 = 0;
+
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 1);
+	__cpuidex((int*)regs7, 7, 0);
+	if (regs[2] & (1 << 27)) xcr0 = _xgetbv(0);
+#else
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+	__get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+	if (regs[2] & (1 << 27))
+	{
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((uint64_t)hi << 32) | lo;
+	}
+#endif
+
+	bool os_avx = (xcr0 & 6) == 6;  // the OS saves the ymm registers
+	res.sse41 = regs[2] & (1 << 19);
+	res.avx   = os_avx && (regs[2] & (1 << 28));
+	res.fma   = res.avx && (regs[2] & (1 << 12));
+	res.avx2  = res.avx && (regs7[1] & (1 << 5));
+	return res;
+}
+
+// can be lowered by hand to benchmark the narrower paths
+Cpu_features cpu = detect_cpu_features();
+
+
+// ===================== 4 wide =====================
+
+// 1/sqrt(x) from the hardware estimate refined by one Newton step, about 23 bits
+inline __m128 rsqrt(__m128 x)
+{
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), yyx));
+}
+
+inline float rsqrt(float x)
+{
+	return _mm_cvtss_f32(rsqrt(_mm_set_ss(x)));
+}
+
+
+struct float4
+{
+	__m128 m;
+
+	float4() = default;
+	float4(__m128 m) : m(m) {}
+	float4(float f) : m(_mm_set1_ps(f)) {}
+
+	static float4 load(const float* ptr) { return _mm_loadu_ps(ptr); }
+	void store(float* ptr) const { _mm_storeu_ps(ptr, m); }
+
+	float4 operator + (const float4& o) const { return _mm_add_ps(m, o.m); }
+	float4 operator - (const float4& o) const { return _mm_sub_ps(m, o.m); }
+	float4 operator * (const float4& o) const { return _mm_mul_ps(m, o.m); }
+	float4 operator / (const float4& o) const { return _mm_div_ps(m, o.m); }
+
+	// comparisons give all bits set lane masks
+	float4 operator < (const float4& o) const { return _mm_cmplt_ps(m, o.m); }
+	float4 operator <= (const float4& o) const { return _mm_cmple_ps(m, o.m); }
+	float4 operator >= (const float4& o) const { return _mm_cmpge_ps(m, o.m); }
+	float4 operator & (const float4& o) const { return _mm_and_ps(m, o.m); }
+
+	int mask() const { return _mm_movemask_ps(m); }
+};
+
+inline float4 select(const float4& mask, const float4& a, const float4& b) { return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)); }
+inline float4 sqrt(const float4& a) { return _mm_sqrt_ps(a.m); }
+inline float4 rsqrt(const float4& a) { return rsqrt(a.m); }
+inline float4 vmin(const float4& a, const float4& b) { return _mm_min_ps(a.m, b.m); }
+inline float4 vmax(const float4& a, const float4& b) { return _mm_max_ps(a.m, b.m); }
+
+
+// ===================== 8 wide, only called when cpu.avx is set =====================
+
+AVX_BEGIN
+
+inline __m256 rsqrt(__m256 x)
+{
+	__m256 y = _mm256_rsqrt_ps(x);
+	__m256 yyx = _mm256_mul_ps(_mm256_mul_ps(y, y), x);
+	return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), yyx));
+}
+
+
+struct float8
+{
+	__m256 m;
+
+	float8() = default;
+	float8(__m256 m) : m(m) {}
+	float8(float f) : m(_mm256_set1_ps(f)) {}
+
+	static float8 load(const float* ptr) { return _mm256_loadu_ps(ptr); }
+	void store(float* ptr) const { _mm256_storeu_ps(ptr, m); }
+
+	float8 operator + (const float8& o) const { return _mm256_add_ps(m, o.m); }
+	float8 operator - (const float8& o) const { return _mm256_sub_ps(m, o.m); }
+	float8 operator * (const float8& o) const { return _mm256_mul_ps(m, o.m); }
+	float8 operator / (const float8& o) const { return _mm256_div_ps(m, o.m); }
+
+	float8 operator < (const float8& o) const { return _mm256_cmp_ps(m, o.m, _CMP_LT_OQ); }
+	float8 operator <= (const float8& o) const { return _mm256_cmp_ps(m, o.m, _CMP_LE_OQ); }
+	float8 operator >= (const float8& o) const { return _mm256_cmp_ps(m, o.m, _CMP_GE_OQ); }
+	float8 operator & (const float8& o) const { return _mm256_and_ps(m, o.m); }
+
+	int mask() const { return _mm256_movemask_ps(m); }
+};
+
+inline float8 select(const float8& mask, const float8& a, const float8& b) { return _mm256_or_ps(_mm256_and_ps(mask.m, a.m), _mm256_andnot_ps(mask.m, b.m)); }
+inline float8 sqrt(const float8& a) { return _mm256_sqrt_ps(a.m); }
+inline float8 rsqrt(const float8& a) { return rsqrt(a.m); }
+inline float8 vmin(const float8& a, const float8& b) { return _mm256_min_ps(a.m, b.m); }
+inline float8 vmax(const float8& a, const float8& b) { return _mm256_max_ps(a.m, b.m); }
+
+AVX_END
@@ -0,0 +1,106 @@
+#include <emmintrin.h>
+#include <cfloat>
+
+
+// log2(x) for normal x > 0, abs error < 1.2e-6
+inline __m128 fast_log2(__m128 x)
+{
+    __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000))), _mm_set1_ps(1.0f));
+
+    __m128 p = _mm_set1_ps(2.001665000e-02f);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-9.462680974e-02f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.139432122e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-3.383771977e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(4.774963637e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-7.211440922e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.442692983e+00f));
+    return _mm_add_ps(e, _mm_mul_ps(p, t));
+}
+
+// 2^x for x in [-126, 0], rel error < 1.1e-7
+inline __m128 fast_exp2(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(-126.0f));
+    __m128i xi = _mm_cvttps_epi32(x);
+    __m128 xf = _mm_cvtepi32_ps(xi);
+    __m128 adjust = _mm_cmpgt_ps(xf, x);  // truncation rounded negative values up
+    xi = _mm_add_epi32(xi, _mm_castps_si128(adjust));
+    xf = _mm_sub_ps(xf, _mm_and_ps(adjust, _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(x, xf);
+
+    __m128 p = _mm_set1_ps(1.8937540581920975e-03f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(8.94959042337237e-03f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.586033707720827e-02f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4014181820146044e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.931544896632286e-01f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.999998983500245e-01f));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(xi, _mm_set1_epi32(127)), 23)));
+}
+
+
+// Precomputed evaluation of x^exponent for x in [0, 1], replaces powf in the lighting loop.
+// Integer exponents are raised by squaring, the rest go through exp2(exponent * log2(x)).
+// Results below 2^-16 are flushed to zero, which lets most of the lights skip the power entirely.
+struct Specular
+{
+    float exponent;
+    int int_exponent;   // -1 if the exponent isn't a small integer
+    float cutoff;
+
+    Specular(float exponent = 0) : exponent(exponent)
+    {
+        int_exponent = exponent >= 0 && exponent <= 65535 && floorf(exponent) == exponent ? (int)exponent : -1;
+        cutoff = exponent > 0 ? exp2f(-16.0f / exponent) : -1.0f;
+    }
+
+    float operator () (float x) const
+    {
+        if (x < cutoff) return 0;
+        if (int_exponent >= 0)
+        {
+            float res = 1.0f;
+            for (int e = int_exponent; e; e >>= 1, x *= x)
+                if (e & 1) res *= x;
+            return res;
+        }
+        return _mm_cvtss_f32(fast_exp2(_mm_mul_ps(_mm_set1_ps(exponent), fast_log2(_mm_set1_ps(x)))));
+    }
+
+    __m128 operator () (__m128 x) const
+    {
+        __m128 keep = _mm_cmpge_ps(x, _mm_set1_ps(cutoff));
+        if (!_mm_movemask_ps(keep)) return _mm_setzero_ps();
+
+        __m128 res;
+        if (int_exponent >= 0)
+        {
+            res = _mm_set1_ps(1.0f);
+            for (int e = int_exponent; e; e >>= 1, x = _mm_mul_ps(x, x))
+                if (e & 1) res = _mm_mul_ps(res, x);
+        }
+        else
+        {
+            x = _mm_max_ps(x, _mm_set1_ps(FLT_MIN));
+            res = fast_exp2(_mm_mul_ps(_mm_set1_ps(exponent), fast_log2(x)));
+        }
+        return _mm_and_ps(res, keep);
+    }
+
+    // sum of weight[i] * x[i]^exponent
+    float sum(const float* x, const float* weight, int count) const
+    {
+        __m128 acc = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            acc = _mm_add_ps(acc, _mm_mul_ps((*this)(_mm_loadu_ps(x + i)), _mm_loadu_ps(weight + i)));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, acc);
+        float res = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (; i < count; i++)
+            res += (*this)(x[i]) * weight[i];
+        return res;
+    }
+};
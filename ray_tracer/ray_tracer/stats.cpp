@@ -0,0 +1,124 @@
+// Ray and traversal counters. With RAY_STATS defined (the debug configurations) every thread
+// counts into its own Ray_stats through RAY_STAT, render() sums them per tile into a Render_stats.
+// Without it RAY_STAT compiles to nothing and the counters stay zero.
+
+#define RAY_STATS_COUNTERS(X) \
+    X(primary)                \
+    X(reflection)             \
+    X(refraction)             \
+    X(shadow)                 \
+    X(shadow_cache_hits)      \
+    X(intersections)          \
+    X(sphere_tests)           \
+    X(plane_tests)            \
+    X(light_nodes)            \
+    X(lights_shaded)
+
+// shadow is the number of shadow_intersect queries, shadow_cache_hits the ones answered by the
+// cached occluder, intersections the closest hit queries, sphere_tests include the SIMD padding
+struct Ray_stats
+{
+#define X(name) uint64_t name = 0;
+    RAY_STATS_COUNTERS(X)
+#undef X
+
+    uint64_t rays() const { return primary + reflection + refraction + shadow; }
+
+    Ray_stats& operator += (const Ray_stats& o)
+    {
+#define X(name) name += o.name;
+        RAY_STATS_COUNTERS(X)
+#undef X
+        return *this;
+    }
+
+    Ray_stats operator - (const Ray_stats& o) const
+    {
+        Ray_stats res;
+#define X(name) res.name = name - o.name;
+        RAY_STATS_COUNTERS(X)
+#undef X
+        return res;
+    }
+
+    void print(const char* title) const
+    {
+        doutput("%s: %llu rays\n", title, (unsigned long long)rays());
+#define X(name) doutput("  %-18s %12llu\n", #name, (unsigned long long)name);
+        RAY_STATS_COUNTERS(X)
+#undef X
+        uint64_t queries = intersections + shadow - shadow_cache_hits;
+        doutput("  sphere tests/query %12.2f\n", queries ? (double)sphere_tests / queries : 0.0);
+        doutput("  light nodes/hit    %12.2f\n", intersections ? (double)light_nodes / intersections : 0.0);
+    }
+};
+
+
+// what the per pixel cost map measures
+enum Cost_metric
+{
+    COST_CYCLES,   // time stamp counter ticks spent on the pixel
+    COST_RAYS,     // rays cast for the pixel, needs RAY_STATS
+};
+
+
+// counters of one render, per tile and per pixel if asked for
+struct Render_stats
+{
+    bool per_tile = false;
+    Ray_stats total;
+    std::vector<Ray_stats> tiles;   // row major, tiles_x per row
+    int tiles_x = 0;
+    std::mutex mutex;
+
+    fImage* cost = NULL;            // same size as the surface, the cost goes to every channel
+    Cost_metric cost_metric = COST_CYCLES;
+
+    void reset(int tiles_x, int tiles_y)
+    {
+        total = Ray_stats();
+        this->tiles_x = tiles_x;
+        tiles.assign(per_tile ? tiles_x * tiles_y : 0, Ray_stats());
+    }
+
+    void add_tile(int tile, const Ray_stats& stats)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        total += stats;
+        if (per_tile) tiles[tile] += stats;
+    }
+};
+
+
+#ifdef RAY_STATS
+thread_local Ray_stats ray_stats;
+#define RAY_STAT(counter, n) (ray_stats.counter += (n))
+#else
+#define RAY_STAT(counter, n)
+#endif
+
+
+inline uint64_t cost_counter(Cost_metric metric)
+{
+#ifdef RAY_STATS
+    if (metric == COST_RAYS) return ray_stats.rays();
+#else
+    (void)metric;
+#endif
+    return __rdtsc();
+}
+
+// the metric cost_counter really measures for metric, rays fall back to cycles without RAY_STATS
+inline Cost_metric measured_cost_metric(Cost_metric metric)
+{
+#ifdef RAY_STATS
+    return metric;
+#else
+    return metric == COST_RAYS ? COST_CYCLES : metric;
+#endif
+}
+
+inline const char* cost_metric_name(Cost_metric metric)
+{
+    return metric == COST_RAYS ? "rays" : "cycles";
+}
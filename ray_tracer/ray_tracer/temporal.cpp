@@ -0,0 +1,139 @@
+// Temporal accumulation for the interactive loop. Every frame renders a few samples per pixel and
+// blends them into the history of the previous frames. When the camera moves, each pixel's first
+// hit is found again from its depth and projected into the previous camera; the history is read
+// there with bilinear taps, and taps whose depth doesn't match were something else last frame
+// (disocclusion), so they are dropped. The scene itself doesn't move, the camera is the only motion.
+
+struct Temporal_settings
+{
+    int max_samples = 64;            // history weight cap, lower reacts faster to lighting changes and smears less
+    float depth_tolerance = 0.03f;   // relative depth difference a history tap may have
+};
+
+struct Temporal_accumulator
+{
+    Temporal_settings settings;
+    int width = 0, height = 0;
+    bool valid = false;   // false until the first frame and after reset()
+    Camera camera;        // of the history
+
+    // ping-ponged, rows top first like render() writes them
+    fImage color[2];
+    std::vector<float> depth[2];
+    std::vector<float> samples[2];   // accumulated per pixel, 0 where the history was rejected
+    int current = 0;
+
+    void resize(int width, int height)
+    {
+        if (width == this->width && height == this->height) return;
+        this->width = width;
+        this->height = height;
+        for (int i = 0; i < 2; i++)
+        {
+            color[i].resize(width, height);
+            depth[i].assign((size_t)width * height, FAR_DEPTH);
+            samples[i].assign((size_t)width * height, 0.0f);
+        }
+        valid = false;
+    }
+
+    void reset() { valid = false; }
+
+    const fImage& result() const { return color[current]; }
+
+    // Blends frame, rendered with camera and spp samples per pixel, into the history and returns
+    // the accumulated colors. depth is the AOV_DEPTH plane of the frame.
+    const fImage& accumulate(const fImage& frame, const std::vector<float>& frame_depth, const Camera& frame_camera, int spp)
+    {
+        PROFILE_ZONE("temporal");
+        assert(frame.width == width && frame.height == height && frame_depth.size() == (size_t)width * height);
+        const int prev = current;
+        const int next = current ^ 1;
+        const bool still = valid && frame_camera == camera;
+        const float cap = (float)(std::max)(settings.max_samples, spp);
+
+        workers.parallel_for(0, height, 8, [&](size_t from_y, size_t to_y)
+        {
+            for (int y = (int)from_y; y < (int)to_y; y++)
+                for (int x = 0; x < width; x++)
+                {
+                    const int idx = x + y * width;
+                    const float d = frame_depth[idx];
+                    fColor history(0.0f, 0.0f, 0.0f);
+                    float history_samples = 0;
+
+                    if (still)
+                    {
+                        history = color[prev].data[idx];
+                        history_samples = samples[prev][idx];
+                    }
+                    else if (valid)
+                        history_samples = reproject(prev, frame_camera, x, y, d, history);
+
+                    // history_samples of what's already there, spp new ones, the oldest fall off at the cap
+                    history_samples = (std::min)(history_samples, cap - spp);
+                    const float total = history_samples + spp;
+                    const float t = spp / total;
+                    const fColor& c = frame.data[idx];
+                    color[next].data[idx] = history_samples > 0 ?
+                        fColor(history.r + (c.r - history.r) * t, history.g + (c.g - history.g) * t, history.b + (c.b - history.b) * t) : c;
+                    samples[next][idx] = total;
+                    depth[next][idx] = d;
+                }
+        });
+
+        current = next;
+        camera = frame_camera;
+        valid = true;
+        return color[current];
+    }
+
+    // history at where pixel x, y of the new frame was seen by the previous camera, returns its
+    // sample count, 0 if none of the taps around that point saw the same surface
+    float reproject(int prev, const Camera& frame_camera, int x, int y, float d, fColor& history) const
+    {
+        const bool far = d >= FAR_DEPTH;
+        vec3f dir = camera_ray(frame_camera, x + 0.5f, y + 0.5f, width, height);
+        // the background is infinitely far, only the rotation moves it
+        vec3f point = far ? camera.position + dir * FAR_DEPTH : frame_camera.position + dir * d;
+
+        float px, py, distance;
+        if (!camera_project(camera, point, width, height, px, py, distance)) return 0;
+
+        px -= 0.5f;
+        py -= 0.5f;
+        const int x0 = (int)floorf(px);
+        const int y0 = (int)floorf(py);
+        const float fx = px - x0;
+        const float fy = py - y0;
+
+        float weight_sum = 0, samples_sum = 0;
+        float r = 0, g = 0, b = 0;
+        for (int ty = 0; ty < 2; ty++)
+            for (int tx = 0; tx < 2; tx++)
+            {
+                const int sx = x0 + tx, sy = y0 + ty;
+                if (sx < 0 || sy < 0 || sx >= width || sy >= height) continue;
+                const int tap = sx + sy * width;
+                if (samples[prev][tap] <= 0) continue;
+
+                const float tap_depth = depth[prev][tap];
+                const bool same = far ? tap_depth >= FAR_DEPTH : fabsf(tap_depth - distance) <= settings.depth_tolerance * distance;
+                if (!same) continue;
+
+                const float w = (tx ? fx : 1.0f - fx) * (ty ? fy : 1.0f - fy);
+                const fColor& c = color[prev].data[tap];
+                r += c.r * w;
+                g += c.g * w;
+                b += c.b * w;
+                samples_sum += samples[prev][tap] * w;
+                weight_sum += w;
+            }
+
+        // a sliver of a tap isn't enough to stand for the pixel
+        if (weight_sum < 0.05f) return 0;
+        const float inv = 1.0f / weight_sum;
+        history = fColor(r * inv, g * inv, b * inv);
+        return samples_sum * inv;
+    }
+};
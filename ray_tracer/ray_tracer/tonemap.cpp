@@ -0,0 +1,142 @@
+// HDR to 8 bit conversion. The renderer writes linear radiance into an fImage and tonemap()
+// turns it into displayable pixels: exposure, a tone curve, optional sRGB encoding and ordered
+// dithering, one pixel per SSE register or two per AVX register.
+
+enum Tonemap_operator
+{
+    TONEMAP_CLAMP,      // values above 1 are cut off, what the renderer always did
+    TONEMAP_REINHARD,   // x / (1 + x)
+    TONEMAP_ACES,       // Narkowicz's fit of the ACES filmic curve
+};
+
+struct Tonemap_settings
+{
+    float exposure = 0.0f;                // in stops, the radiance is scaled by 2^exposure
+    Tonemap_operator op = TONEMAP_CLAMP;
+    bool srgb = false;                    // encode with the sRGB transfer curve instead of writing linear values
+    bool dither = false;                  // 8x8 ordered dither of half a step against banding
+};
+
+
+// Bayer offsets in -0.5..0.5, 4 floats per pixel (no offset for alpha). Rows are 16 pixels, the
+// second 8 repeat the first, so 2 pixels can be loaded from any position.
+struct Tonemap_dither
+{
+    float offsets[8][16 * 4];
+};
+
+Tonemap_dither make_tonemap_dither()
+{
+    Tonemap_dither res;
+    for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 16; x++)
+        {
+            int v = 0;
+            for (int bit = 0; bit < 3; bit++)
+                v = (v << 2) | ((((x ^ y) >> bit) & 1) << 1) | ((y >> bit) & 1);
+
+            float* pixel = &res.offsets[y][x * 4];
+            pixel[0] = pixel[1] = pixel[2] = (v + 0.5f) / 64.0f - 0.5f;
+            pixel[3] = 0.0f;
+        }
+    return res;
+}
+
+const Tonemap_dither tonemap_dither = make_tonemap_dither();
+
+
+template <typename F>
+SIMD_INLINE F tonemap_curve(const F& x, Tonemap_operator op)
+{
+    switch (op)
+    {
+        case TONEMAP_REINHARD: return x / (x + F(1.0f));
+        case TONEMAP_ACES:     return (x * (x * F(2.51f) + F(0.03f))) / (x * (x * F(2.43f) + F(0.59f)) + F(0.14f));
+        default:               return x;
+    }
+}
+
+// x in 0..1, the power segment is approximated with square roots, within 0.25 of a step at 8 bits
+template <typename F>
+SIMD_INLINE F srgb_encode(const F& x)
+{
+    F s1 = sqrt(x);
+    F s2 = sqrt(s1);
+    F s3 = sqrt(s2);
+    F curve = s1 * F(0.662002687f) + s2 * F(0.684122060f) - s3 * F(0.323583601f) - x * F(0.0225411470f);
+    return select(x <= F(0.0031308f), x * F(12.92f), curve);
+}
+
+// v is already scaled to 0..255.5, the packs saturate and alpha is always opaque
+SIMD_INLINE void store_pixels(const float4& v, Color* dst)
+{
+    __m128i i = _mm_cvttps_epi32(v.m);
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    dst->whole = _mm_cvtsi128_si32(i) | 0xFF000000;
+}
+
+// converts pixels x0..x1 of one row and returns where it stopped, less than one register of pixels may be left
+template <typename F>
+SIMD_INLINE int tonemap_span(const fColor* src, Color* dst, int x0, int x1, int y, const Tonemap_settings& settings)
+{
+    const int step = sizeof(F) / sizeof(fColor);
+    const F scale(exp2f(settings.exposure));
+    const float* dither = tonemap_dither.offsets[y & 7];
+
+    int x = x0;
+    for (; x + step <= x1; x += step)
+    {
+        // NaNs and negatives end up black, the upper bound keeps the curves finite
+        F v = vmin(vmax(F::load(src[x].raw) * scale, F(0.0f)), F(65504.0f));
+        v = vmin(tonemap_curve(v, settings.op), F(1.0f));
+        if (settings.srgb) v = srgb_encode(v);
+        v = v * F(255.0f) + F(0.5f);
+        if (settings.dither) v = v + F::load(dither + (x & 7) * 4);
+        store_pixels(v, dst + x);
+    }
+    return x;
+}
+
+AVX_BEGIN
+
+inline void store_pixels(const float8& v, Color* dst)
+{
+    __m256i i = _mm256_cvttps_epi32(v.m);
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extractf128_si256(i, 1));
+    packed = _mm_packus_epi16(packed, packed);
+    _mm_storel_epi64((__m128i*)dst, _mm_or_si128(packed, _mm_set1_epi32(0xFF000000)));
+}
+
+SIMD_FLATTEN int tonemap_span_avx(const fColor* src, Color* dst, int x0, int x1, int y, const Tonemap_settings& settings)
+{
+    return tonemap_span<float8>(src, dst, x0, x1, y, settings);
+}
+
+AVX_END
+
+SIMD_FLATTEN void tonemap_row(const fColor* src, Color* dst, int x0, int x1, int y, const Tonemap_settings& settings)
+{
+    if (cpu.avx) x0 = tonemap_span_avx(src, dst, x0, x1, y, settings);
+    tonemap_span<float4>(src, dst, x0, x1, y, settings);
+}
+
+
+// converts the x0..x1, y0..y1 rectangle of hdr into the same pixels of out, both must be the same size
+void tonemap(const fImage& hdr, Image& out, const Tonemap_settings& settings, int x0, int y0, int x1, int y1)
+{
+    assert(hdr.width == out.width && hdr.height == out.height);
+    for (int y = y0; y < y1; y++)
+        tonemap_row(hdr.data + y * hdr.width, out.data + y * out.width, x0, x1, y, settings);
+}
+
+// the whole image, rows are split over the workers
+void tonemap(const fImage& hdr, Image& out, const Tonemap_settings& settings)
+{
+    PROFILE_ZONE("tonemap");
+    assert(hdr.width == out.width && hdr.height == out.height);
+    workers.parallel_for(0, hdr.height, 16, [&](size_t from_y, size_t to_y)
+    {
+        tonemap(hdr, out, settings, 0, from_y, hdr.width, to_y);
+    });
+}
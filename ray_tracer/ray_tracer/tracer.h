@@ -0,0 +1,25 @@
+#pragma once
+
+// the whole ray tracer as one unity build, shared by the viewer and the benchmark
+#include "guiAlexandrov/include.h"
+
+
+#define PI 3.14159265359f
+#include "simd.cpp"
+#include "geometry.cpp"
+#include "stats.cpp"
+#include "tonemap.cpp"
+#include "aov.cpp"
+#include "denoise.cpp"
+#include "sampler.cpp"
+#include "light_tree.cpp"
+#include "specular.cpp"
+#include "ray_caster.cpp"
+#include "relight.cpp"
+#include "temporal.cpp"
+#include "interactive.cpp"
+#include "progressive.cpp"
+#include "crop.cpp"
+#include "scenes.cpp"
+#include "net.cpp"
+#include "distributed.cpp"